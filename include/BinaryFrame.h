@@ -0,0 +1,129 @@
+/*
+ * Framed binary command protocol (opcodes, CRC8, frame parser).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __BINARY_FRAME_H__
+#define __BINARY_FRAME_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Frame: [0xA5][len][opcode][payload (len bytes)][crc8]
+ * crc8 (poly 0x07, init 0) covers len, opcode and payload. Multi byte values are
+ * little endian. A reply uses opcode | BIN_REPLY and starts with a status byte.
+ * Text mode connections switch to frames with the BIN command (after its OK),
+ * BIN_OP_TEXT_MODE switches back.
+ */
+#define BIN_SYNC            (0xA5)
+#define BIN_MAX_PAYLOAD     (250)
+#define BIN_FRAME_OVERHEAD  (4)
+#define BIN_REPLY           (0x80)
+
+/* Opcodes */
+#define BIN_OP_PING         (0x01)   /* -> [status][version]                                      */
+#define BIN_OP_TEXT         (0x02)   /* [text command line], text replies come as BIN_OP_TEXT frames */
+#define BIN_OP_TEXT_MODE    (0x03)   /* Back to the text protocol (after the reply)               */
+#define BIN_OP_MOVE         (0x10)   /* [u16 duration ms][i32 dx microsteps] x N -> [status][accepted] */
+#define BIN_OP_CUT_LIST     (0x11)   /* [u16 count][u32 length um] x N -> [status]                */
+#define BIN_OP_STOP         (0x12)   /* -> [status]                                               */
+#define BIN_OP_STATUS       (0x13)   /* -> [status][i32 pos][i32 target][u8 queue][u8 free]       */
+#define BIN_OP_MAX          (0x20)   /* Opcodes 0 .. BIN_OP_MAX-1 can have handlers               */
+
+#define BIN_VERSION         (1)
+
+/* Reply status */
+#define BIN_OK              (0)
+#define BIN_BUSY            (1)      /* Motion pipeline full, nothing (more) accepted - resend    */
+#define BIN_BAD_LENGTH      (2)
+#define BIN_UNKNOWN         (3)
+#define BIN_BAD_VALUE       (4)
+#define BIN_BAD_CRC         (5)      /* Sent with opcode BIN_REPLY (0x80), the frame was dropped  */
+
+/*!
+ * \brief CRC8 (poly 0x07).
+ */
+static inline uint8_t bin_crc8(const uint8_t *d, int len, uint8_t crc = 0)
+{
+	while (len--) {
+		crc ^= *d++;
+		for (int i = 0; i < 8; ++i) crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+	}
+	return crc;
+}
+//===========================================================================================
+
+static inline uint16_t bin_get_u16(const uint8_t *p) {return p[0] | (p[1] << 8);}
+static inline uint32_t bin_get_u32(const uint8_t *p) {return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);}
+static inline void bin_put_u16(uint8_t *p, uint16_t v) {p[0] = v; p[1] = v >> 8;}
+static inline void bin_put_u32(uint8_t *p, uint32_t v) {p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;}
+
+/*!
+ * \brief Build frame in out (len + BIN_FRAME_OVERHEAD bytes), returns frame length.
+ */
+static inline int bin_encode(uint8_t *out, uint8_t op, const uint8_t *payload, int len)
+{
+	out[0] = BIN_SYNC;
+	out[1] = len;
+	out[2] = op;
+	if (len) memcpy(out + 3, payload, len);
+	out[3 + len] = bin_crc8(out + 1, len + 2);
+	return len + BIN_FRAME_OVERHEAD;
+}
+//===========================================================================================
+
+/*!
+ * \brief Byte-wise frame parser. The payload is collected into an external buffer
+ * (the text line buffer of the connection - both modes are never active at once).
+ */
+class BinaryFramer {
+public:
+	enum {WAIT_SYNC, WAIT_LEN, WAIT_OP, PAYLOAD, WAIT_CRC};
+
+	BinaryFramer(uint8_t *buf): m_buf(buf), m_frames(0), m_errors(0) {reset();}
+	void reset() {m_state = WAIT_SYNC; m_len = 0; m_pos = 0; m_op = 0;}
+
+	/*!
+	 * \brief Feed one byte.
+	 * \return 1 - frame complete (m_op, m_buf, m_len), -1 - CRC/length error (frame dropped), 0 - more data needed.
+	 */
+	int feed(uint8_t b) {
+		switch (m_state) {
+			case WAIT_SYNC: if (b == BIN_SYNC) m_state = WAIT_LEN; break;
+			case WAIT_LEN:
+				if (b > BIN_MAX_PAYLOAD) {m_errors++; reset(); return -1;}
+				m_len = b; m_crc = bin_crc8(&b, 1); m_state = WAIT_OP;
+				break;
+			case WAIT_OP:
+				m_op = b; m_crc = bin_crc8(&b, 1, m_crc); m_pos = 0;
+				m_state = m_len ? PAYLOAD : WAIT_CRC;
+				break;
+			case PAYLOAD:
+				m_buf[m_pos++] = b;
+				if (m_pos == m_len) {m_crc = bin_crc8(m_buf, m_len, m_crc); m_state = WAIT_CRC;}
+				break;
+			case WAIT_CRC:
+				m_state = WAIT_SYNC;
+				if (b != m_crc) {m_errors++; return -1;}
+				m_frames++;
+				return 1;
+		}
+		return 0;
+	}
+public:
+	uint8_t  *m_buf;
+	uint8_t   m_state;
+	uint8_t   m_len;
+	uint8_t   m_pos;
+	uint8_t   m_op;
+	uint8_t   m_crc;
+	uint32_t  m_frames;    /*!< Good frames.            */
+	uint32_t  m_errors;    /*!< Dropped (CRC, length).  */
+};
+
+#endif // __BINARY_FRAME_H__
@@ -1,5 +1,5 @@
 /*
- * Base class for commands (NetworkCommand, HTTPCommand, ...).
+ * Base class for commands (NetworkCommand, SerialCommand, HTTPCommand, ...).
  *
  * Author: Rafal Vonau <rafal.vonau@gmail.com>
  *
@@ -12,11 +12,15 @@
 
 #include <Arduino.h>
 #include <memory>
-#include <list>
 #include <map>
 #include <utility>
 #include <string.h>
-#include <functional>
+#include "CommandTable.h"
+#include "CommandMacro.h"
+#include "Delegate.h"
+#include "BinaryFrame.h"
+#include "ResponseWriter.h"
+#include "LatencyTrace.h"
 
 #if 1
 #define cmddebug(x)
@@ -27,35 +31,130 @@
 #endif
 
 // Size of the input buffer in bytes (maximum length of one command plus arguments)
-#define COMMAND_BUFFER (63)
+#define COMMAND_BUFFER (255)
+// Maximum number of arguments of one command
+#define COMMAND_MAX_ARGS (12)
+// Number of preallocated queue items (command and motion queue together)
+#define COMMAND_POOL_SIZE (32)
 
 class Command;
 class CommandQueueItem;
 
-typedef std::function<void(CommandQueueItem *c)> CommandQueueCB;
+typedef Delegate<void(CommandQueueItem *c)> CommandQueueCB;
+
+// Maximum reply payload of a binary handler (status byte not included)
+#define BIN_REPLY_MAX (32)
+
+/*!
+ * \brief Binary opcode handler, called on reception (not queued).
+ * \param in, len - request payload, out, outLen - reply payload (at most BIN_REPLY_MAX bytes).
+ * \return reply status (BIN_OK, BIN_BUSY, ...).
+ */
+typedef Delegate<int(Command *c, const uint8_t *in, int len, uint8_t *out, int *outLen)> BinaryCB;
+
+/*
+ * Real-time commands (grbl style single bytes, text mode only). They are acted on
+ * in the receive path (not queued) and never enter the line buffer.
+ */
+#define RT_STOP             (0x18)   // Ctrl-X: stop motion, flush queued motion commands
+#define RT_HOLD             ('!')    // Feed hold
+#define RT_RESUME           ('~')    // Resume after hold
+#define RT_STATUS           ('?')    // Status line
+// Latency limit of a real-time command (reception to handler done) [us]
+#define RT_LATENCY_LIMIT    (100)
+
+/*!
+ * \brief Real-time command handler (called from the receive callback).
+ */
+typedef Delegate<void(Command *c, uint8_t rt)> RealtimeCB;
+
+/*!
+ * \brief Command with a text argument (file name, ...), executed on reception (not queued).
+ * \param args - text after the first ',' (NULL - none).
+ */
+typedef Delegate<void(Command *c, int32_t seq, const char *args)> TextCommandCB;
+// Number of text commands
+#define COMMAND_TEXT_MAX (4)
+
+/* Argument parser result */
+#define CMD_PARSE_OK        (0)
+#define CMD_PARSE_SYNTAX    (1)   // Not a number
+#define CMD_PARSE_RANGE     (2)   // Value does not fit in 32 bits
+#define CMD_PARSE_TOO_MANY  (3)   // More than COMMAND_MAX_ARGS arguments
 
 /*!
- * \brief Queued command item.
+ * \brief Parse one number ("-12", "2.5"), p is left at the ',' or the end of the string.
+ */
+int commandParseNumber(const char *&p, int32_t *ip, int16_t *frac);
+/*! Reply texts of the CMD_PARSE_* codes. */
+extern const char * const commandParseErrors[];
+
+/*!
+ * \brief Queued command item (lives in the CommandDB pool).
  */
 class CommandQueueItem {
 public:
-	CommandQueueItem(Command *c, char *cmdline, CommandQueueCB cb);
-	~CommandQueueItem();
-	void print(String s);
-	void printInt(int i) {this->print(String(i) +"\r\nOK\r\n");       }
-	void sendAck()       {this->print("OK\r\n");                      }
-	void sendError()     {this->print("!8 Err: Unknown command\r\n"); }
-	void sendErrorText(String s) {this->print("!8 Err: "+s+"\r\n"); }
+	CommandQueueItem(): m_argc(0), m_arg_mask(0), m_seq(-1), m_tRecv(0), m_tQueued(0), m_parent(NULL), m_next(NULL) {}
+	/*!
+	 * \brief Fill item, parse arguments in one pass ("12,-3,2.5", NULL - no arguments).
+	 * \return CMD_PARSE_OK or error code.
+	 */
+	int set(Command *c, const char *args, const CommandQueueCB &cb);
+	/*!
+	 * \brief Argument in thousandths (fixed point, "2.5" -> 2500), e.g. micrometres for a value in mm.
+	 * 64 bit, any 32 bit argument times 1000 fits (range check at the caller).
+	 */
+	int64_t argMilli(int i) const {return (int64_t)m_arg[i] * 1000 + m_frac[i];}
+	void print(const char *s, int len);
+	void print(const char *s)     {this->print(s, strlen(s));             }
+	void print(const String &s)   {this->print(s.c_str(), s.length());    }
+	void printInt(int i) {ResponseWriter(this).printf("%d\r\nOK\r\n", i);   }
+	void sendAck()       {ResponseWriter(this).ok();                       }
+	void sendError()     {ResponseWriter(this).error("Unknown command");   }
+	void sendErrorText(const char *s) {ResponseWriter(this).error(s);      }
 	void execute() {m_cb(this);}                          // Execute (use calback function)
 public:
-	int            m_arg0;
-	int            m_arg1;
-	int            m_arg2;
-	int            m_arg_mask;
+	int32_t        m_arg[COMMAND_MAX_ARGS];   // Integer part of the arguments
+	int16_t        m_frac[COMMAND_MAX_ARGS];  // Fraction [1/1000], same sign as the value
+	int            m_argc;                    // Number of arguments
+	uint32_t       m_arg_mask;                // Bit n set - argument n present
+	int32_t        m_seq;                     // Sequence number (N<seq> prefix), -1 - none
+	uint32_t       m_tRecv;                   // Received (ccount, latency trace)
+	uint32_t       m_tQueued;                 // Queued (ccount)
 	Command       *m_parent;        // Pointer to parent (SerialCommand or NetworkCommand)
 	CommandQueueCB m_cb;            // Calback function
+	CommandQueueItem *m_next;       // Next item in the queue (or free list)
+};
+
+/*!
+ * \brief Intrusive FIFO of queue items (links are stored in the items).
+ */
+class CommandFifo {
+public:
+	CommandFifo(): m_head(NULL), m_tail(NULL), m_count(0) {}
+	void push(CommandQueueItem *i) {
+		i->m_next = NULL;
+		if (m_tail) m_tail->m_next = i; else m_head = i;
+		m_tail = i;
+		m_count++;
+	}
+	CommandQueueItem *pop() {
+		CommandQueueItem *i = m_head;
+		if (i) {
+			m_head = i->m_next;
+			if (!m_head) m_tail = NULL;
+			i->m_next = NULL;
+			m_count--;
+		}
+		return i;
+	}
+	bool empty() const {return m_head == NULL;}
+	int  size()  const {return m_count;}
+public:
+	CommandQueueItem *m_head;
+	CommandQueueItem *m_tail;
+	int               m_count;
 };
-typedef std::shared_ptr<CommandQueueItem> CommandQueueItemPtr;
 
 
 class CommandDBItem {
@@ -73,7 +172,7 @@ typedef std::shared_ptr<CommandDBItem> CommandDBItemPtr;
  */
 class CommandDB {
 public:
-	CommandDB(): m_defaultHandler(NULL) {}
+	CommandDB();
 	/*!
 	 * \brief Add command to the database.
 	 * \param command    - command name,
@@ -81,47 +180,193 @@ public:
 	 * \param waitMotors - if true use motion queue instand of command queue.
 	 */
 	void addCommand(const char *command, CommandQueueCB fn, bool waitMotors = false);
+	/*!
+	 * \brief Connection closed - queued commands of c keep running, their replies are dropped.
+	 * The detach handler is called too (other holders of c forget it).
+	 */
+	void detach(Command *c);
+	/*!
+	 * \brief Register binary opcode handler (opcode < BIN_OP_MAX).
+	 */
+	void addBinary(uint8_t opcode, BinaryCB cb) {if (opcode < BIN_OP_MAX) m_binary[opcode] = cb;}
+	/*!
+	 * \brief Register command with a text argument (checked before the built-in table).
+	 */
+	bool addTextCommand(const char *name, TextCommandCB cb) {
+		if (m_textCount == COMMAND_TEXT_MAX) return false;
+		m_text[m_textCount].name = name;
+		m_text[m_textCount].cb   = cb;
+		m_textCount++;
+		return true;
+	}
+	/*!
+	 * \brief Set real-time command handler (RT_STOP, RT_HOLD, RT_RESUME, RT_STATUS).
+	 */
+	void setRealtime(RealtimeCB cb) {m_realtime = cb;}
+	/*!
+	 * \brief Run real-time command, t0 - cycle count at reception (latency statistics).
+	 */
+	void executeRealtime(Command *c, uint8_t rt, uint32_t t0);
+	/*!
+	 * \brief Drop all queued motion commands (replies "!8 Err: <reason>").
+	 */
+	void cancelMotion(const char *reason);
+	/*!
+	 * \brief Real-time command counters (RT).
+	 */
+	void printRealtime(CommandQueueItem *c);
+	/*!
+	 * \brief List of macros (MAC).
+	 */
+	void printMacros(CommandQueueItem *c);
+	/*!
+	 * \brief Set table of built-in commands (looked up before the runtime commands).
+	 */
+	void setTable(const CommandTableView &table) {m_table = table;}
 	/*!
 	 * \brief Set handler called when command was not found in the database.
 	 */
 	void setDefaultHandler(void (*function)(const char *, Command *c)) {m_defaultHandler = function;}
+	/*!
+	 * \brief Set handler called when a connection is closed (see detach()).
+	 */
+	void setDetachHandler(void (*function)(Command *c)) {m_detachHandler = function;}
 	/*!
 	 * \brief Parse command line and add command to queue.
 	 */
 	void executeCommand(Command *c, char *line);
+	/*!
+	 * \brief Check command line without executing it (name known, arguments parse), line is modified.
+	 * \return NULL - valid, otherwise the error text.
+	 */
+	const char *check(char *line);
+	/*!
+	 * \brief Execute binary frame (payload must have room for a terminating zero).
+	 */
+	void executeBinary(Command *c, uint8_t opcode, uint8_t *payload, int len);
+	/*!
+	 * \brief Lookups per second: std::map<String> (runtime commands) vs built-in table.
+	 */
+	void benchLookup(CommandQueueItem *c);
+	/*!
+	 * \brief Handler call cost: std::function vs Delegate (cycles per call, object size).
+	 */
+	void benchDispatch(CommandQueueItem *c);
+	/*!
+	 * \brief Pool and lookup counters (QS).
+	 */
+	void printStat(CommandQueueItem *c);
 	/*!
 	 * \brief Execute single command from command queue.
 	 */
 	void loop() {
-		if (m_commandQueue.size()) {
-			m_commandQueue.front()->execute();
-			m_commandQueue.pop_front();
-		}
+		CommandQueueItem *i = m_commandQueue.pop();
+		if (i) run(i);
+	}
+	/*!
+	 * \brief Credits for a client: motion commands that can be sent now.
+	 * \param motionFree - free entries in the motion pipeline after the command queue.
+	 */
+	int credits(int motionFree) {
+		int c = motionFree - m_motionQueue.size();
+		if (c > m_free.size()) c = m_free.size();
+		return (c < 0) ? 0 : c;
 	}
 	/*!
 	 * \brief Execute single command from motion queue.
 	 */
 	void loopMotion() {
-		if (m_motionQueue.size()) {
-			m_motionQueue.front()->execute();
-			m_motionQueue.pop_front();
+		CommandQueueItem *i = m_motionQueue.pop();
+		if (i) {
+			m_motionOwner = i->m_parent;
+			run(i);
 		}
 	}
 
+	/*!
+	 * \brief Commands rejected so far because the pool was empty.
+	 */
+	uint32_t rejected() const {return m_poolExhausted;}
+	/*!
+	 * \brief Commands of connection c still in the queues.
+	 */
+	int pending(const Command *c) const;
+	/*!
+	 * \brief Connection that queued the current motion (gets the motion errors, NULL - none).
+	 * Set by the motion queue, commands that queue motion themselves call setMotionOwner().
+	 */
+	Command *motionOwner() const {return m_motionOwner;}
+	void setMotionOwner(Command *c) {m_motionOwner = c;}
+
 	bool isMotinQueueEmpty() {
-		if (m_motionQueue.size()) return false;
-		return true;
+		return m_motionQueue.empty();
 	}
 
+protected:
+	/*!
+	 * \brief Take item from the pool (NULL - pool exhausted, the command is rejected).
+	 */
+	CommandQueueItem *take() {
+		CommandQueueItem *i = m_free.pop();
+		if (!i) {
+			m_poolExhausted++;
+			return NULL;
+		}
+		m_poolTaken++;
+		if ((COMMAND_POOL_SIZE - m_free.size()) > m_poolPeak) m_poolPeak = COMMAND_POOL_SIZE - m_free.size();
+		return i;
+	}
+	void release(CommandQueueItem *i);
+	/*!
+	 * \brief Execute and release queued item.
+	 */
+	void run(CommandQueueItem *i);
+	/*!
+	 * \brief Macro definition (DEF ... END) and macro call.
+	 */
+	void defineMacro(Command *c, int32_t seq, const char *command, const char *args);
+	void executeMacro(Command *c, int32_t seq, const CommandMacro *m, const char *args);
+	void replyError(Command *c, int32_t seq, const char *text);
+	void releaseItem(CommandQueueItem *i) {
+		i->m_cb     = nullptr;
+		i->m_parent = NULL;
+		m_free.push(i);
+	}
 public:
-	/* Command database */
+	/* Built-in commands */
+	CommandTableView m_table;
+	/* Runtime commands */
 	std::map<String, CommandDBItemPtr> m_commandMap;
+	/* Binary opcodes */
+	BinaryCB m_binary[BIN_OP_MAX];
+	/* Real-time commands */
+	RealtimeCB m_realtime;
+	/* Macros */
+	CommandMacros    m_macros;
+	/* Commands with a text argument */
+	struct {const char *name; TextCommandCB cb;} m_text[COMMAND_TEXT_MAX];
+	int              m_textCount;
 	// Pointer to the default handler function
 	void (*m_defaultHandler)(const char *, Command *c);
+	// Pointer to the detach handler function
+	void (*m_detachHandler)(Command *c);
+	/* Queue items */
+	CommandQueueItem m_pool[COMMAND_POOL_SIZE];
+	CommandFifo      m_free;
 	/* Command Queue */
-	std::list<CommandQueueItemPtr> m_commandQueue;
+	CommandFifo      m_commandQueue;
 	/* Motion Queue */
-	std::list<CommandQueueItemPtr> m_motionQueue;
+	CommandFifo      m_motionQueue;
+	/* Counters */
+	uint32_t         m_poolTaken;       // Items taken from the pool
+	uint32_t         m_poolExhausted;   // Commands rejected (pool empty)
+	int              m_poolPeak;        // Most items in use at once
+	uint32_t         m_mapLookups;      // Runtime command lookups (String temporary on the heap)
+	uint32_t         m_rtCount;         // Real-time commands executed
+	uint32_t         m_rtLast;          // Latency of the last one [cycles]
+	uint32_t         m_rtMax;           // Worst latency [cycles]
+	uint32_t         m_rtOver;          // Real-time commands over RT_LATENCY_LIMIT
+	Command         *m_motionOwner;     // Connection that queued the current motion
 };
 
 /*!
@@ -129,16 +374,98 @@ public:
  */
 class Command {
 public:
-	Command(CommandDB *db):  m_db(db) {clearBuffer();}      // Constructor
+	Command(CommandDB *db):  m_db(db), m_overflow(false), m_overflows(0), m_binaryCapable(false), m_binary(false), m_realtimeBytes(true), m_framer((uint8_t *)buffer),
+		m_lastSeq(-1), m_tRecv(0), m_creditInterval(0), m_creditLast(0), m_creditSent(-1) {clearBuffer(); resetLatency();}      // Constructor
 
-	virtual void print(String s) {}
+	/*!
+	 * \brief Text output (s is zero terminated at s[len]). In binary mode the text
+	 * is sent as BIN_OP_TEXT frames, otherwise with write().
+	 */
+	virtual void print(const char *s, int len) {
+		if (printFramed(s, len)) return;
+		write((const uint8_t *)s, len);
+	}
+	void print(const char *s)   {print(s, strlen(s));}
+	void print(const String &s) {print(s.c_str(), s.length());}
+	virtual void write(const uint8_t *data, int len) {}   // Raw output (binary frames)
 	virtual void loop() {};
+	/*!
+	 * \brief Switch between text lines and binary frames (false - transport can not do binary).
+	 */
+	bool setBinaryMode(bool on) {
+		if (on && !m_binaryCapable) return false;
+		m_binary = on;
+		m_framer.reset();
+		clearBuffer();
+		return true;
+	}
+	/*!
+	 * \brief Credit report "CRD,<credits>,<last executed seq>" every m_creditInterval [ms]
+	 * (and at once when the credits changed since the last report). Called from the main loop.
+	 */
+	void creditTick(int credits, bool force = false) {
+		uint32_t now = millis();
+		if (!force) {
+			if (m_creditInterval == 0) return;
+			if ((credits == m_creditSent) && ((now - m_creditLast) < m_creditInterval)) return;
+			if ((now - m_creditLast) < 10) return;      // At most 100 reports/s
+		}
+		m_creditLast = now;
+		m_creditSent = credits;
+		ResponseWriter(this).printf("CRD,%d,%d\r\n", credits, m_lastSeq);
+	}
+	/*!
+	 * \brief Send binary frame (message based transports replace the framing).
+	 */
+	virtual void sendFrame(uint8_t op, const uint8_t *payload, int len) {
+		uint8_t f[BIN_MAX_PAYLOAD + BIN_FRAME_OVERHEAD];
+		write(f, bin_encode(f, op, payload, len));
+	}
+	/*!
+	 * \brief In binary mode send text as BIN_OP_TEXT reply frames (true - sent).
+	 */
+	bool printFramed(const char *s, int len) {
+		int pos = 0, n;
+		if (!m_binary) return false;
+		while (pos < len) {
+			n = len - pos;
+			if (n > BIN_MAX_PAYLOAD) n = BIN_MAX_PAYLOAD;
+			sendFrame(BIN_OP_TEXT | BIN_REPLY, (const uint8_t *)s + pos, n);
+			pos += n;
+		}
+		return true;
+	}
+	/*!
+	 * \brief Split received data into lines (\r or \n) or binary frames and execute them.
+	 * Lines longer than COMMAND_BUFFER are rejected with an error (not truncated).
+	 */
+	void handleData(const char *data, int len);
 	
 	void clearBuffer() { buffer[0] = '\0';bufPos = 0; }  // Clears the input buffer.	
+	/*!
+	 * \brief Commands of this connection and their received -> executed latency
+	 * ("cmds=,avg=us,max=us", compares transports: serial, TCP, ...).
+	 */
+	void printLatency(ResponseWriter &w);
+	void resetLatency() {m_cmdCount = 0; m_cmdLatMax = 0; m_cmdLatSum = 0;}
 public:
 	char       buffer[COMMAND_BUFFER + 1]; // Buffer of stored characters while waiting for terminator character
-	byte       bufPos;                     // Current position in the buffer
+	uint16_t   bufPos;                     // Current position in the buffer
 	CommandDB *m_db;                       // Commands database
+	bool       m_overflow;                 // Current line did not fit into the buffer
+	uint32_t   m_overflows;                // Rejected (too long) lines
+	bool       m_binaryCapable;            // Transport can send binary frames (BIN command)
+	bool       m_binary;                   // Binary frames instead of text lines
+	bool       m_realtimeBytes;            // Real-time bytes (RT_STOP, '!', '~', '?') act at once, not in lines
+	BinaryFramer m_framer;                 // Binary frame parser (payload in buffer)
+	int32_t    m_lastSeq;                  // Last executed sequence number
+	uint32_t   m_tRecv;                    // Reception of the data being parsed (ccount)
+	uint32_t   m_creditInterval;           // Credit report period [ms], 0 - off
+	uint32_t   m_creditLast;               // Last credit report [ms]
+	int        m_creditSent;               // Credits in the last report
+	uint32_t   m_cmdCount;                 // Commands executed (latency trace)
+	uint32_t   m_cmdLatMax;                // Worst received -> executed [cycles]
+	uint64_t   m_cmdLatSum;                // Sum of received -> executed [cycles]
 };
 
 #endif //__COMMAND_H__
@@ -0,0 +1,98 @@
+/*
+ * Command macros (named command sequences stored pre-parsed).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __COMMAND_MACRO_H__
+#define __COMMAND_MACRO_H__
+
+#include <stdint.h>
+#include "CommandTable.h"
+
+// Number of macros
+#define MACRO_MAX        (8)
+// Longest macro name
+#define MACRO_NAME       (8)
+// Bytecode memory shared by all macros
+#define MACRO_BYTES      (512)
+// Most steps of one macro (all steps are queued at once)
+#define MACRO_MAX_STEPS  (16)
+
+/*
+ * Definition (per connection, every line is compiled, not executed):
+ *
+ *   DEF,CF          - start macro CF (an existing macro is replaced on END)
+ *   CT              - built-in commands only, arguments are numbers or $1..$9
+ *   MR,$1           - (parameters of the call)
+ *   END             - store, a macro without steps is deleted
+ *
+ *   CF,2.5          - queue all steps (no parsing of the steps), MAC - list macros
+ *
+ * A call gets one reply (with the N<seq> of the call) from the step that runs
+ * last (the last motion step, if any), output of the other steps is dropped.
+ *
+ * Bytecode of one step: [u8 built-in table index][u8 argc] + argc arguments:
+ */
+#define MACRO_ARG_I8     (0)   // [i8]
+#define MACRO_ARG_I32    (1)   // [i32]
+#define MACRO_ARG_FIX    (2)   // [i32][i16 fraction]
+#define MACRO_ARG_PARAM  (3)   // [u8 n] - argument n of the call (0 based)
+
+class Command;
+class CommandQueueItem;
+
+/*!
+ * \brief Stored macro.
+ */
+typedef struct CommandMacro_s {
+	char     name[MACRO_NAME + 1];
+	uint16_t off;                      /*!< Bytecode offset in CommandMacros::m_code. */
+	uint16_t len;                      /*!< Bytecode length.                          */
+	uint8_t  steps;                    /*!< Number of commands.                       */
+	uint8_t  params;                   /*!< Arguments the call must give.             */
+} CommandMacro;
+
+/*!
+ * \brief Macro compiler and store.
+ * Error results are reply texts (NULL - OK).
+ */
+class CommandMacros {
+public:
+	CommandMacros(): m_rec(NULL), m_count(0), m_used(0) {}
+
+	/*!
+	 * \brief Start definition of macro name by connection c (DEF).
+	 */
+	const char *begin(Command *c, const char *name);
+	/*!
+	 * \brief Compile one line of the definition (command name and arguments split).
+	 */
+	const char *add(const CommandTableView &table, const char *command, const char *args);
+	/*!
+	 * \brief Store the macro (END).
+	 */
+	const char *end();
+	void cancel() {m_rec = NULL;}
+	const CommandMacro *find(const char *name) const;
+	/*!
+	 * \brief Decode one step into i (arguments only), params - arguments of the call.
+	 * \return next step.
+	 */
+	static const uint8_t *decode(const uint8_t *p, const CommandQueueItem *params, CommandQueueItem *i, uint8_t *entry);
+protected:
+	void remove(int n);
+	bool put(const void *d, int len);
+public:
+	Command      *m_rec;                 // Connection defining a macro (NULL - none)
+	CommandMacro  m_def;                 // Macro being defined (bytecode after m_used)
+	CommandMacro  m_macros[MACRO_MAX];
+	int           m_count;
+	uint16_t      m_used;                // Bytecode of the stored macros
+	uint8_t       m_code[MACRO_BYTES];
+};
+
+#endif // __COMMAND_MACRO_H__
@@ -0,0 +1,139 @@
+/*
+ * Compile time (perfect hash) table of built-in commands.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __COMMAND_TABLE_H__
+#define __COMMAND_TABLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * The table is built by the compiler: the constructor searches for a hash seed
+ * that maps every name to its own slot, so lookup is one hash, one slot read
+ * and one strcmp - no heap, no String temporaries. Duplicate names (or a table
+ * the seed search cannot separate) stop the build.
+ *
+ *   static constexpr CommandTableEntry cmds[] = {{"v", cmdVersion, false}, ...};
+ *   COMMAND_TABLE(table, cmds);
+ *   CmdDB.setTable(table.view());
+ */
+
+class CommandQueueItem;
+
+typedef void (*CommandFn)(CommandQueueItem *c);
+
+/*!
+ * \brief Built-in command.
+ */
+typedef struct CommandTableEntry_s {
+	const char *name;
+	CommandFn   fn;
+	bool        waitMotors;          /*!< Use motion queue instand of command queue. */
+} CommandTableEntry;
+
+/*!
+ * \brief Seeded FNV-1a hash (the same function at compile and run time).
+ */
+static constexpr uint32_t commandHash(const char *s, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+	while (*s) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+	/* FNV low bits only see the low bits of the characters - mix before masking */
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	return h;
+}
+
+static constexpr bool commandNameEq(const char *a, const char *b)
+{
+	while (*a && (*a == *b)) {a++; b++;}
+	return *a == *b;
+}
+
+/*!
+ * \brief Type independent view used by CommandDB.
+ */
+class CommandTableView {
+public:
+	constexpr CommandTableView(): m_entries(NULL), m_slots(NULL), m_count(0), m_mask(0), m_seed(0) {}
+	constexpr CommandTableView(const CommandTableEntry *e, const uint8_t *s, uint32_t count, uint32_t mask, uint32_t seed):
+		m_entries(e), m_slots(s), m_count(count), m_mask(mask), m_seed(seed) {}
+
+	/*!
+	 * \brief Find command (NULL - not a built-in command).
+	 */
+	const CommandTableEntry *find(const char *name) const {
+		if (!m_slots) return NULL;
+		uint8_t i = m_slots[commandHash(name, m_seed) & m_mask];
+		if (i && (strcmp(m_entries[i - 1].name, name) == 0)) return &m_entries[i - 1];
+		return NULL;
+	}
+public:
+	const CommandTableEntry *m_entries;
+	const uint8_t           *m_slots;
+	uint32_t                 m_count;
+	uint32_t                 m_mask;
+	uint32_t                 m_seed;
+};
+
+/*!
+ * \brief Perfect hash table for N commands (2N..4N slots, index + 1 per slot).
+ */
+template<size_t N>
+class CommandTable {
+	static_assert((N > 0) && (N < 255), "CommandTable holds 1..254 commands");
+	static constexpr size_t slotsFor(size_t n) {size_t s = 1; while (s < 2 * n) s <<= 1; return s;}
+public:
+	static constexpr size_t SLOTS = slotsFor(N);
+
+	constexpr CommandTable(const CommandTableEntry (&e)[N]): m_entries{}, m_slots{}, m_seed(0), m_valid(true) {
+		for (size_t i = 0; i < N; ++i) {
+			m_entries[i] = e[i];
+			for (size_t j = 0; j < i; ++j) {
+				if (commandNameEq(e[i].name, e[j].name)) m_valid = false;
+			}
+		}
+		while (m_valid && !fill(m_seed)) {
+			if (++m_seed > 4096) m_valid = false;
+		}
+	}
+
+	constexpr CommandTableView view() const {return CommandTableView(m_entries, m_slots, N, SLOTS - 1, m_seed);}
+	constexpr size_t size() const {return N;}
+	constexpr bool valid() const {return m_valid;}
+protected:
+	constexpr bool fill(uint32_t seed) {
+		for (size_t i = 0; i < SLOTS; ++i) m_slots[i] = 0;
+		for (size_t i = 0; i < N; ++i) {
+			uint32_t h = commandHash(m_entries[i].name, seed) & (SLOTS - 1);
+			if (m_slots[h]) return false;
+			m_slots[h] = i + 1;
+		}
+		return true;
+	}
+public:
+	CommandTableEntry m_entries[N];
+	uint8_t           m_slots[SLOTS];
+	uint32_t          m_seed;
+	bool              m_valid;
+};
+
+/*!
+ * \brief Define constexpr table from an array of CommandTableEntry (checked at compile time).
+ */
+#define COMMAND_TABLE(name, entries) \
+	static constexpr CommandTable<sizeof(entries) / sizeof(entries[0])> name(entries); \
+	static_assert(name.valid(), "Duplicate command name in " #entries)
+
+#endif // __COMMAND_TABLE_H__
@@ -0,0 +1,91 @@
+/*
+ * Non allocating callback (replacement of std::function for handlers).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __DELEGATE_H__
+#define __DELEGATE_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bytes available for the callable (plain function, or a lambda capturing up to two pointers)
+#define DELEGATE_STORAGE (2 * sizeof(void *))
+
+template<typename Sig> class Delegate;
+
+/*!
+ * \brief Callback stored in place: the callable is copied into a small buffer and
+ * called through one thunk pointer. Callables that do not fit (or are not
+ * trivially copyable) are rejected at compile time, so a Delegate never
+ * allocates. Accepts:
+ *  - function pointer,
+ *  - function pointer with context: Delegate(fn, ctx), fn(void *ctx, args...),
+ *  - lambda / functor up to DELEGATE_STORAGE bytes.
+ */
+template<typename R, typename... A>
+class Delegate<R(A...)> {
+public:
+	typedef R (*Fn)(A...);
+	typedef R (*CtxFn)(void *, A...);
+
+	Delegate(): m_invoke(NULL) {}
+	Delegate(std::nullptr_t): m_invoke(NULL) {}
+
+	Delegate(Fn fn) {
+		if (fn) {
+			new (m_storage) Fn(fn);
+			m_invoke = &callFn;
+		} else {
+			m_invoke = NULL;
+		}
+	}
+
+	Delegate(CtxFn fn, void *ctx) {
+		Bound b = {fn, ctx};
+		new (m_storage) Bound(b);
+		m_invoke = &callBound;
+	}
+
+	template<typename F, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+	Delegate(F f) {
+		typedef typename std::decay<F>::type T;
+		if constexpr (std::is_convertible<T, Fn>::value) {
+			/* Function or capture-less lambda */
+			new (m_storage) Fn((Fn)f);
+			m_invoke = &callFn;
+		} else {
+			static_assert(sizeof(T) <= DELEGATE_STORAGE, "Delegate: callable too big (capture less or use fn + context)");
+			static_assert(alignof(T) <= alignof(void *), "Delegate: callable alignment");
+			static_assert(std::is_trivially_copyable<T>::value, "Delegate: callable must be trivially copyable");
+			new (m_storage) T(f);
+			m_invoke = &callFunctor<T>;
+		}
+	}
+
+	R operator()(A... args) const {return m_invoke(m_storage, std::forward<A>(args)...);}
+	explicit operator bool() const {return m_invoke != NULL;}
+	bool operator==(std::nullptr_t) const {return m_invoke == NULL;}
+	bool operator!=(std::nullptr_t) const {return m_invoke != NULL;}
+protected:
+	typedef struct {CtxFn fn; void *ctx;} Bound;
+	typedef R (*Invoke)(const void *, A...);
+
+	static R callFn(const void *s, A... args) {return (*(const Fn *)s)(std::forward<A>(args)...);}
+	static R callBound(const void *s, A... args) {const Bound *b = (const Bound *)s; return b->fn(b->ctx, std::forward<A>(args)...);}
+	template<typename T>
+	static R callFunctor(const void *s, A... args) {return (*(const T *)s)(std::forward<A>(args)...);}
+protected:
+	Invoke m_invoke;
+	alignas(void *) unsigned char m_storage[DELEGATE_STORAGE];
+};
+
+#endif // __DELEGATE_H__
@@ -0,0 +1,101 @@
+/*
+ * EspNowCommand - Execute binary opcodes sent over ESP-NOW (pendant, foot pedal).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ESPNOW_COMMAND_H__
+#define __ESPNOW_COMMAND_H__
+
+#include "Command.h"
+#include "EspNowLink.h"
+
+// Paired senders (EN,<s> opens the pairing window, EN,0 forgets them)
+#define ESPNOW_MAX_PEERS (2)
+// Longest pairing window [s]
+#define ESPNOW_PAIR_MAX  (300)
+// Message header: sequence number and opcode
+#define ESPNOW_HEADER    (2)
+
+/*
+ * Message (one ESP-NOW frame, the radio checks the CRC):
+ *   request: [u8 seq][opcode][payload]                  opcodes and payloads of BinaryFrame.h
+ *   reply:   [u8 seq][opcode | BIN_REPLY][status][data]
+ *   text:    [u8 seq][BIN_OP_TEXT | BIN_REPLY][text]    (replies of BIN_OP_TEXT commands)
+ * seq 0 - no duplicate check. A request with the seq of the previous one is not
+ * executed again, its reply is repeated (a pedal resends until it gets the reply).
+ */
+
+/*!
+ * \brief One ESP-NOW sender, replies go back to its MAC.
+ */
+class EspNowPeer: public Command {
+public:
+	EspNowPeer(): Command(NULL), m_link(NULL), m_rxSeq(0), m_inRx(false), m_replyLen(0), m_rx(0), m_dups(0) {
+		m_binaryCapable = true;
+		memset(m_mac, 0, sizeof(m_mac));
+	}
+
+	void attach(CommandDB *db, EspNowLink *link, const uint8_t *mac);
+	void detach();
+	bool active() const {return m_link != NULL;}
+	bool is(const uint8_t *mac) const {return active() && (memcmp(m_mac, mac, ESPNOW_MAC_LEN) == 0);}
+	/*!
+	 * \brief Execute received message.
+	 */
+	void receive(const uint8_t *data, int len);
+
+	virtual void sendFrame(uint8_t op, const uint8_t *payload, int len);
+	virtual void write(const uint8_t *data, int len) {sendFrame(BIN_OP_TEXT | BIN_REPLY, data, len);}
+public:
+	EspNowLink *m_link;
+	uint8_t     m_mac[ESPNOW_MAC_LEN];
+	uint8_t     m_rxSeq;                    // Sequence number of the last request
+	bool        m_inRx;                     // Executing a request (its first reply is kept)
+	uint8_t     m_reply[ESPNOW_HEADER + BIN_REPLY_MAX + 1];
+	int         m_replyLen;                 // Reply of the last request (0 - none)
+	uint32_t    m_rx;                       // Requests received
+	uint32_t    m_dups;                     // Repeated requests (not executed)
+};
+
+/*!
+ * \brief ESP-NOW endpoint: binary opcodes go straight to CommandDB (no TCP/IP
+ * stack, no connection), BIN_OP_TEXT carries any text command.
+ * Only paired senders are served. A new sender is paired only while the pairing
+ * window is open (pair()), messages of unknown senders are dropped.
+ */
+class EspNowCommand {
+public:
+	EspNowCommand(CommandDB *db, EspNowLink *link);
+
+	bool begin();
+	/*!
+	 * \brief Accept new senders for seconds (EN,seconds, 1..ESPNOW_PAIR_MAX).
+	 */
+	bool pair(uint32_t seconds);
+	bool pairing();
+	/*!
+	 * \brief Forget all senders and close the pairing window (EN,0).
+	 */
+	void unpair();
+	/*!
+	 * \brief Link and peer counters (EN).
+	 */
+	void printStat(CommandQueueItem *c);
+protected:
+	void onReceive(const uint8_t *mac, const uint8_t *data, int len);
+public:
+	CommandDB  *m_db;
+	EspNowLink *m_link;
+	bool        m_ok;                       // Link started
+	uint32_t    m_pairStart;                // Pairing window opened [ms]
+	uint32_t    m_pairTime;                 // Pairing window length [ms], 0 - closed
+	uint32_t    m_rejected;                 // Messages from unknown senders (not paired)
+	uint32_t    m_errors;                   // Messages shorter than the header
+	EspNowPeer  m_peers[ESPNOW_MAX_PEERS];
+};
+
+#endif // __ESPNOW_COMMAND_H__
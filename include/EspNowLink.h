@@ -0,0 +1,80 @@
+/*
+ * ESP-NOW link (radio and loopback mock for host tests).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ESPNOW_LINK_H__
+#define __ESPNOW_LINK_H__
+
+#include <stdint.h>
+#include <string.h>
+#include "Delegate.h"
+
+// Largest ESP-NOW message [bytes]
+#define ESPNOW_MAX_DATA (250)
+#define ESPNOW_MAC_LEN  (6)
+
+/*!
+ * \brief Received message (called in the WiFi task context, like the TCP callbacks).
+ */
+typedef Delegate<void(const uint8_t *mac, const uint8_t *data, int len)> EspNowRecvCB;
+
+/*!
+ * \brief Message transport used by EspNowCommand.
+ */
+class EspNowLink {
+public:
+	virtual ~EspNowLink() {}
+	virtual bool begin() = 0;
+	/*!
+	 * \brief Make mac a known peer (needed before the first send() to it).
+	 */
+	virtual bool addPeer(const uint8_t *mac) = 0;
+	virtual bool send(const uint8_t *mac, const uint8_t *data, int len) = 0;
+	void onReceive(EspNowRecvCB cb) {m_recv = cb;}
+public:
+	EspNowRecvCB m_recv;
+};
+
+/*!
+ * \brief ESP-NOW on the WiFi radio (one instance, the SDK has a single receive callback).
+ * Messages are sent on the current WiFi channel, a pendant must use the channel of the AP
+ * the controller is connected to (or of its own soft AP), but needs no connection.
+ */
+class EspNowRadio: public EspNowLink {
+public:
+	EspNowRadio(): m_sendFail(0) {}
+	virtual bool begin();
+	virtual bool addPeer(const uint8_t *mac);
+	virtual bool send(const uint8_t *mac, const uint8_t *data, int len);
+public:
+	uint32_t m_sendFail;                   // Messages not acknowledged by the peer
+};
+
+/*!
+ * \brief Two ends connected back to back: send() on one end is received at once
+ * by the other one (host tests of EspNowCommand, pendant simulation).
+ */
+class EspNowLoopback: public EspNowLink {
+public:
+	EspNowLoopback(const uint8_t *mac): m_other(NULL), m_sent(0) {memcpy(m_mac, mac, ESPNOW_MAC_LEN);}
+	void connect(EspNowLoopback *other) {m_other = other; other->m_other = this;}
+	virtual bool begin() {return true;}
+	virtual bool addPeer(const uint8_t *mac) {return true;}
+	virtual bool send(const uint8_t *mac, const uint8_t *data, int len) {
+		if (!m_other || (len > ESPNOW_MAX_DATA)) return false;
+		m_sent++;
+		if (m_other->m_recv) m_other->m_recv(m_mac, data, len);
+		return true;
+	}
+public:
+	EspNowLoopback *m_other;
+	uint8_t         m_mac[ESPNOW_MAC_LEN];
+	uint32_t        m_sent;
+};
+
+#endif // __ESPNOW_LINK_H__
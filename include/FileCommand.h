@@ -0,0 +1,93 @@
+/*
+ * FileCommand - execute command scripts stored on LittleFS.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __FILECOMMAND_H__
+#define __FILECOMMAND_H__
+
+#include "Command.h"
+#include <LittleFS.h>
+
+// Bytes read from the file at once
+#define FILE_CHUNK          (128)
+// Most lines fed per main loop (keeps the loop short)
+#define FILE_LINES_PER_LOOP (4)
+// Longest script name
+#define FILE_NAME           (31)
+// Reply line held to tell "OK" from other replies (longer lines are passed on)
+#define FILE_REPLY          (48)
+
+/*!
+ * \brief Script job: the file is read in FILE_CHUNK parts and its lines are fed into
+ * CommandDB only while the pipeline has credits, so a long program runs at queue
+ * speed without holding more than one chunk in RAM.
+ * "OK" replies (with or without "N<seq> ") are counted, other replies go to the
+ * connection that started the job, the first error stops the job. The job is
+ * done when the file is fed and none of its commands is left in the queues.
+ * Real-time bytes are not interpreted, "!" in a script line is plain text.
+ *
+ * Scripts are uploaded with "pio run -t uploadfs" (data/ directory) or POST /upload.
+ */
+class FileCommand: public Command {
+public:
+	FileCommand(CommandDB *db): Command(db), m_mounted(false), m_owner(NULL), m_chunkLen(0), m_chunkPos(0), m_eof(false),
+		m_replyLen(0), m_replyLong(false) {m_name[0] = '\0'; m_realtimeBytes = false;}
+
+	/*!
+	 * \brief Mount LittleFS.
+	 */
+	bool begin();
+	/*!
+	 * \brief Start script name, owner gets the job replies (error text, NULL - started).
+	 */
+	const char *start(Command *owner, const char *name);
+	/*!
+	 * \brief Stop the job (commands already queued still run).
+	 */
+	void abort(const char *reason);
+	/*!
+	 * \brief Connection c was closed: the job keeps running, its replies are dropped.
+	 */
+	void detach(Command *c) {if (m_owner == c) m_owner = NULL;}
+	/*!
+	 * \brief Feed up to credits lines (called from the main loop).
+	 */
+	void feed(int credits);
+	bool running() {return m_file ? true : false;}
+	void printStat(ResponseWriter &w);
+	void list(ResponseWriter &w);
+	bool remove(const char *name);
+
+	using Command::print;
+	virtual void print(const char *s, int len);
+protected:
+	void finish(const char *state);
+	void replyLine();
+	void passReply();
+	static bool path(char *out, const char *name);
+public:
+	bool      m_mounted;
+	File      m_file;
+	Command  *m_owner;                      // Connection that started the job
+	char      m_name[FILE_NAME + 1];
+	char      m_chunk[FILE_CHUNK];
+	int       m_chunkLen;
+	int       m_chunkPos;
+	bool      m_eof;                        // File fed, waiting for the queued commands
+	char      m_reply[FILE_REPLY + 1];      // Reply line being received
+	int       m_replyLen;
+	bool      m_replyLong;                  // Reply line longer than FILE_REPLY (passed on in parts)
+	uint32_t  m_size;                       // Script size [bytes]
+	uint32_t  m_bytes;                      // Bytes fed
+	uint32_t  m_lines;                      // Lines fed
+	uint32_t  m_ok;                         // OK replies
+	uint32_t  m_errors;                     // Error replies
+	uint32_t  m_start;                      // Job start [ms]
+};
+
+#endif // __FILECOMMAND_H__
@@ -13,24 +13,58 @@
 #include "Command.h"
 #include <ESPAsyncTCP.h>
 #include <ESPAsyncWebServer.h>
+#include <LittleFS.h>
 
+// Script a batch (POST /batch) is spooled to, it runs as a RUN job
+#define BATCH_FILE      ".batch"
+// Macros defined in one batch (calls to them are not checked)
+#define BATCH_MACROS    (MACRO_MAX)
+// Invalid lines listed in the response (the rest are only counted)
+#define BATCH_ERRORS    (8)
 
+/*!
+ * \brief Web UI (/post - one command, replies over /events).
+ *
+ * POST /batch (Content-Type: text/plain) takes a whole program, one command per
+ * line. Lines are checked as the body arrives (only one line is held in RAM) and
+ * the body is spooled to BATCH_FILE. When every line is valid the file is started
+ * as a RUN job, it runs at queue speed and its replies come over /events.
+ * The response lists the first BATCH_ERRORS invalid lines as
+ * "L<line>,<error>" and ends with "BATCH,lines=,errors=,run=<started|reason>"
+ * (HTTP 400 when not started).
+ */
 class HTTPCommand: public Command {
 public:
 	HTTPCommand(CommandDB *db);
 	~HTTPCommand();
 
-	virtual void print(String s) {
+	using Command::print;
+	virtual void print(const char *s, int len) {
 		if (m_events) {
-			m_events->send(s.c_str(), "cmd");
+			m_events->send(s, "cmd");
 		}
 		cmddebug(s);
 	}
 	virtual void readSerial() {};
-	void handleData(const char *data, int len);
+protected:
+	void batchBody(AsyncWebServerRequest *request, const uint8_t *data, size_t len, size_t index);
+	void batchLine();
+	void batchDone(AsyncWebServerRequest *request);
 public:
 	AsyncWebServer   *m_server;
 	AsyncEventSource *m_events;
+	/* Batch in progress */
+	AsyncWebServerRequest *m_batchReq;     // NULL - none
+	File      m_batchFile;
+	String    m_batchResult;
+	char      m_batchLine[COMMAND_BUFFER + 1];
+	int       m_batchLen;
+	bool      m_batchOverflow;
+	bool      m_batchDef;                  // Inside DEF ... END
+	uint32_t  m_batchLines;
+	uint32_t  m_batchErrors;
+	char      m_batchMacros[BATCH_MACROS][MACRO_NAME + 1];
+	int       m_batchMacroCount;
 };
 
 #endif // __HTTPCOMMAND_H__
@@ -0,0 +1,71 @@
+/*
+ * Command latency tracing (ccount stamps, log2 histograms per stage).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __LATENCY_TRACE_H__
+#define __LATENCY_TRACE_H__
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*! Stamp commands on their way from the packet to the motor (LAT command) */
+#define LATENCY_TRACE
+
+// Histogram buckets: bucket n counts [2^n, 2^(n+1)) cycles, the last one everything above
+#define LAT_BUCKETS (24)
+
+/*
+ * Stages (stamps: received in handleData, queued in executeCommand, executed in
+ * CmdDB.loop, motion segment started, motion finished):
+ */
+enum {
+	LAT_PARSE = 0,      // received -> queued (parse, lookup)
+	LAT_QUEUE,          // queued -> executed (command / motion queue wait)
+	LAT_EXEC,           // handler run time (servo delays show here)
+	LAT_MOTIONQ,        // executed -> motion segment started (Motion1D queue wait)
+	LAT_MOTION,         // motion segment started -> finished
+	LAT_TOTAL,          // received -> motion segment started
+	LAT_STAGES
+};
+
+class ResponseWriter;
+
+class LatencyTrace {
+public:
+	LatencyTrace() {reset();}
+
+	void record(int stage, uint32_t cycles) {
+		int b = cycles ? (31 - __builtin_clz(cycles)) : 0;
+		if (b >= LAT_BUCKETS) b = LAT_BUCKETS - 1;
+		m_hist[stage][b]++;
+		m_count[stage]++;
+		if (cycles > m_max[stage]) m_max[stage] = cycles;
+	}
+	void reset();
+	/*!
+	 * \brief Per stage: count, max, p50/p99 (bucket bounds) and the histogram.
+	 */
+	void print(ResponseWriter &w);
+public:
+	uint32_t m_recv;                        // Stamps of the command being executed (0 - none)
+	uint32_t m_exec;
+	uint32_t m_hist[LAT_STAGES][LAT_BUCKETS];
+	uint32_t m_count[LAT_STAGES];
+	uint32_t m_max[LAT_STAGES];
+};
+
+#ifdef LATENCY_TRACE
+extern LatencyTrace latencyTrace;
+#define LAT_STAMP()               ESP.getCycleCount()
+#define LAT_RECORD(stage, cycles) latencyTrace.record(stage, cycles)
+#else
+#define LAT_STAMP()               (0)
+#define LAT_RECORD(stage, cycles)
+#endif
+
+#endif // __LATENCY_TRACE_H__
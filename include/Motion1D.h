@@ -19,12 +19,17 @@
 #include "osapi.h"
 #include "Command.h"
 
-/*! Use AccelStepper lib or simple but fast (no ramp implementation) timer1 based solution */
+/*! Step backend: StepTimer1 (fast timer1 ISR with ramp), StepI2S (I2S DMA, STEP on GPIO3),
+    StepAccel (AccelStepper lib) or StepSim (no hardware) */
+//#define MOTION_BACKEND StepAccel
+
+/*! Compatibility: same as MOTION_BACKEND StepAccel */
 //#define USE_ACCEL_STEPPER
 
-#ifdef USE_ACCEL_STEPPER
-#include "AccelStepper.h" // nice lib from http://www.airspayce.com/mikem/arduino/AccelStepper/
-#endif
+/*! Measure step ISR run time in CPU cycles (reported by printStat) */
+//#define MOTION_ISR_PROFILE
+
+#include "StepBackend.h"
 
 #define MOTION_QUEUE_SIZE (64)
 
@@ -34,24 +39,47 @@ typedef struct motion_queue_s {
 	uint16_t cmd;
 	uint16_t duration;
 	int x;
+#ifdef LATENCY_TRACE
+	uint32_t t_recv;      /*!< Stamps of the command that queued the entry (0 - none). */
+	uint32_t t_exec;
+#endif
 } motion_queue_t;
 #endif
 
 
-extern volatile int x_target;
-extern volatile int x_pos;
-
-
 class Motion1D
 {
 public:
-	Motion1D(int step1, int dir1, int en_pin, int servoPin);
+	/*! Pins known at run time only (ISR loads the STEP mask from motion_state_t). */
+	Motion1D(int step1, int dir1, int en_pin, int servoPin) {init(step1, dir1, en_pin, servoPin, MotionBackend::isr<0>());}
+protected:
+	Motion1D(int step1, int dir1, int en_pin, int servoPin, const motion_isr_pair_t &isr) {init(step1, dir1, en_pin, servoPin, isr);}
+public:
 
 	void motorsOff();
 	void motorsOn();
 	void toggleMotors();
 	
 	void stop();
+	/*!
+	 * \brief Feed hold: the running move ramps down and pauses (backends with ISR support),
+	 * no further queue entries are started (the queue is kept), resume with hold(false).
+	 */
+	void hold(bool on) {m_hold = on; m_backend.feedHold(on);}
+	bool held() {return m_hold;}
+	/*!
+	 * \brief Feed rate override [%], applies to the running move (false - out of range or unsupported).
+	 */
+	bool feedOverride(int percent) {
+		if (!m_backend.feedOverride(percent)) return false;
+		m_feed = percent;
+		return true;
+	}
+	int feed() {return m_feed;}
+	/*!
+	 * \brief Reason the motion was stopped and the queue flushed (NULL - none), cleared by the read.
+	 */
+	const char *fault() {const char *f = m_fault; m_fault = NULL; return f;}
 
 	boolean loop();
 
@@ -73,6 +101,10 @@ public:
 		v->cmd = cmd;
 		v->duration = duration;
 		v->x = x;
+#ifdef LATENCY_TRACE
+		v->t_recv = latencyTrace.m_recv;
+		v->t_exec = latencyTrace.m_exec;
+#endif
 		pos++;
 		pos &= MOTION_QUEUE_MASK;
 		m_motionQWr = pos;
@@ -97,42 +129,90 @@ public:
 		return false;
 	}
 
+	int motionQ_depth() {
+		return (m_motionQWr - m_motionQRd) & MOTION_QUEUE_MASK;
+	}
+
+	/*! Free entries (motionQ_is_full() keeps the last three for a cut). */
+	int motionQ_free() {
+		return (MOTION_QUEUE_SIZE - 1) - motionQ_depth();
+	}
+
 
 	void motionQ_pull() {
 		if (m_motionQWr != m_motionQRd) {
 			int pos = m_motionQRd;
-			motion_queue_t *v = &m_motionQ[pos];
-			switch (v->cmd) {
-				case 1: goToReal(v->duration, v->x); break;
-				case 2: setCutterUpReal(v->duration); break;
-				case 3: setCutterDownReal(v->duration); break;
-				case 4: toggleCutterReal(v->duration); break;
-				default: break;
-			}
+			motion_queue_t v = m_motionQ[pos];
+			/* Consume the entry first: a real-time stop may flush the queue while the servo delay() yields */
 			pos++;
 			pos &= MOTION_QUEUE_MASK;
 			m_motionQRd = pos;
+#ifdef LATENCY_TRACE
+			m_latRecv = v.t_recv;
+			m_latExec = v.t_exec;
+#endif
+			switch (v.cmd) {
+				case 1: goToReal(v.duration, v.x); break;
+				case 2: setCutterUpReal(v.duration); break;
+				case 3: setCutterDownReal(v.duration); break;
+				case 4: toggleCutterReal(v.duration); break;
+				default: break;
+			}
 		}
 	}
 #else
+	int motionQ_depth() {return 0;}
+	int motionQ_free() {return m_backend.busy() ? 0 : 1;}
 	void setCutterUp(int d = 0) {setCutterUpReal(d);}
 	void setCutterDown(int d = 0) {setCutterDownReal(d);}
 	void toggleCutter(int d = 0) {toggleCutterReal(d);}
-	void goTo(uint16_t duration, int xSteps) {goToReal(duration, xSteps);}
+	void goTo(uint16_t duration, int xSteps) {
+#ifdef LATENCY_TRACE
+		m_latRecv = latencyTrace.m_recv;
+		m_latExec = latencyTrace.m_exec;
+#endif
+		goToReal(duration, xSteps);
+	}
 #endif
 	void printStat(CommandQueueItem *c);
+	/*!
+	 * \brief Consistent copy of position, target, phase, speed and queue depth.
+	 * Lock-free, safe to call at any rate from the main loop (does not disable interrupts).
+	 */
+	void snapshot(motion_snapshot_t *snap);
+
+	int position() {return m_backend.position();}
+	void setZero() {m_backend.setZero();}
+	/*!
+	 * \brief Run step backend benchmark (motors are disabled for the run).
+	 * \param sim - benchmark the simulated backend instead of the active one.
+	 */
+	void bench(CommandQueueItem *c, bool sim = false);
+	/*!
+	 * \brief Lower the driver microstep resolution at cruise speed (see StepTimer1).
+	 * \param set - reprogram the driver resolution, NULL - disable.
+	 */
+	bool adaptiveMicrosteps(int native, int cruise, bool (*set)(int microsteps)) {return m_backend.adaptiveMicrosteps(native, cruise, set);}
+protected:
+	void init(int step1, int dir1, int en_pin, int servoPin, const motion_isr_pair_t &isr);
 public:
-#ifdef USE_ACCEL_STEPPER
-	AccelStepper *m_xMotor;
-#else
-	int           m_x_dir;
-#endif
+	MotionBackend m_backend;
 	boolean       m_motorsEnabled;
+	volatile bool m_hold;
+	int           m_feed;
+	const char   *m_fault;
 	int           m_en_pin;
 	/* Servo */
 	int           m_cutterState;
 	int           m_cutterUpPos;
 	int           m_cutterDownPos;
+#ifdef LATENCY_TRACE
+	/* Stamps of the move being started / running */
+	uint32_t      m_latRecv;
+	uint32_t      m_latExec;
+	uint32_t      m_latStart;
+	bool          m_latRun;
+#endif
 #ifdef MOTION_QUEUE_SIZE
 	motion_queue_t m_motionQ[MOTION_QUEUE_SIZE];
 	int            m_motionQWr;
@@ -140,4 +220,17 @@ public:
 #endif
 };
 
-#endif
\ No newline at end of file
+/*!
+ * \brief Motion1D with STEP/DIR pins fixed at compile time.
+ * The step ISR is instantiated for this STEP pin, so its gpio mask is an immediate.
+ */
+template<int STEP_PIN, int DIR_PIN>
+class Motion1DPins: public Motion1D
+{
+	static_assert((STEP_PIN >= 0) && (STEP_PIN < 16), "STEP must be GPIO0..GPIO15");
+	static_assert((DIR_PIN >= 0) && (DIR_PIN < 16), "DIR must be GPIO0..GPIO15");
+public:
+	Motion1DPins(int en_pin, int servoPin): Motion1D(STEP_PIN, DIR_PIN, en_pin, servoPin, MotionBackend::template isr<(1u << STEP_PIN)>()) {}
+};
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * Multi axis (ND) coordinated motion for ESP8266, one timer1 step ISR for all axes.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __MOTION_ND__
+#define __MOTION_ND__
+
+#include "Arduino.h"
+#include <stdint.h>
+#include "motion_isr.h"
+#include "StepBackend.h"
+#include "core_esp8266_waveform.h"
+
+/*
+ * Every segment moves all axes by delta[i] steps in the same time. The axis with
+ * the largest delta (dominant) steps on every tick and carries the tabled ramp,
+ * the other axes are distributed with Bresenham error terms, so all of them start
+ * and finish together. STEP pins of all axes that step on a tick are raised with
+ * one gpio write.
+ *
+ * MotionND owns timer1 like StepTimer1 - use it instead of Motion1D, not next to it.
+ */
+
+#define MOTION_ND_QUEUE_SIZE (16)
+#define MOTION_ND_QUEUE_MASK (MOTION_ND_QUEUE_SIZE-1)
+
+/*!
+ * \brief ISR state. r holds the timing and the dominant axis progress (0..total).
+ */
+template<int N>
+struct motion_nd_state_t {
+	motion_state_t    r;               /*!< Timing, ramp, progress of the dominant axis.      */
+	uint32_t          out;             /*!< STEP masks raised on the last rising edge.        */
+	int32_t           total;           /*!< Dominant axis steps in this segment.              */
+	int32_t           pos[N];          /*!< Axis position [microsteps].                       */
+	int32_t           delta[N];        /*!< Axis steps in this segment (abs).                 */
+	int32_t           err[N];          /*!< Bresenham error term.                             */
+	int32_t           dir[N];          /*!< +1 / -1.                                          */
+	uint32_t          mask[N];         /*!< STEP gpio mask.                                   */
+} __attribute__((aligned(16)));
+
+template<int N>
+class MotionND
+{
+	static_assert((N >= 1) && (N <= 8), "MotionND supports 1..8 axes");
+public:
+	typedef struct segment_s {
+		uint16_t duration;
+		int32_t  delta[N];
+	} segment_t;
+
+	/*!
+	 * \param step, dir - N gpio numbers (GPIO0..GPIO15), step == NULL - no pin output (benchmark).
+	 */
+	MotionND(const int *step, const int *dir, int en_pin): m_en_pin(en_pin) {
+		int i;
+
+		setTimer1Callback(NULL);
+		memset(&st, 0, sizeof(st));
+		for (i = 0; i < N; ++i) {
+			if (step) {
+				pinMode(step[i], OUTPUT);
+				pinMode(dir[i], OUTPUT);
+				digitalWrite(step[i], LOW);
+				st.mask[i]    = (1 << step[i]);
+				m_dir_mask[i] = (1 << dir[i]);
+			} else {
+				st.mask[i]    = 0;
+				m_dir_mask[i] = 0;
+			}
+		}
+		if (en_pin >= 0) pinMode(en_pin, OUTPUT);
+		m_qWr = m_qRd = 0;
+		m_in_motion = 0;
+		motorsOff();
+	}
+
+	void motorsOff() {if (m_en_pin >= 0) digitalWrite(m_en_pin, HIGH); m_motorsEnabled = false;}
+	void motorsOn()  {if (m_en_pin >= 0) digitalWrite(m_en_pin, LOW);  m_motorsEnabled = true; }
+
+	/*!
+	 * \brief Queue coordinated move (relative, delta[N] microsteps in duration [ms]).
+	 * \return false - queue full.
+	 */
+	bool goTo(uint16_t duration, const int32_t *delta) {
+		int pos = (m_qWr + 1) & MOTION_ND_QUEUE_MASK;
+		if (pos == m_qRd) return false;
+		m_q[m_qWr].duration = duration;
+		memcpy(m_q[m_qWr].delta, delta, sizeof(m_q[0].delta));
+		m_qWr = pos;
+		return true;
+	}
+
+	bool queueFull() {return ((m_qWr + 1) & MOTION_ND_QUEUE_MASK) == m_qRd;}
+	bool queueEmpty() {return m_qWr == m_qRd;}
+
+	/*!
+	 * \brief Executed in main loop (returns true when the queue is full).
+	 */
+	bool loop() {
+		if (!busy() && (m_qWr != m_qRd)) {
+			start(m_q[m_qRd].duration, m_q[m_qRd].delta, false);
+			m_qRd = (m_qRd + 1) & MOTION_ND_QUEUE_MASK;
+		}
+		return queueFull();
+	}
+
+	bool busy() {
+		if (m_in_motion && (((volatile motion_state_t *)&st.r)->active == 0)) {
+			setTimer1Callback(NULL);
+			m_in_motion = 0;
+		}
+		return m_in_motion;
+	}
+
+	/*!
+	 * \brief Soft stop, flush the queue. Axes keep the positions they reached.
+	 */
+	void stop() {
+		uint32_t ps;
+
+		m_qWr = m_qRd = 0;
+		ps = motion_irq_lock();
+		motion_write_begin(&st.r);
+		((volatile motion_state_t *)&st.r)->target = ((volatile motion_state_t *)&st.r)->pos;
+		motion_write_end(&st.r);
+		motion_irq_unlock(ps);
+	}
+
+	/*!
+	 * \brief Consistent copy of all axis positions (seqlock, see Motion1D::snapshot).
+	 */
+	void snapshot(int32_t *pos) {
+		volatile motion_nd_state_t<N> *s = &st;
+		uint32_t seq;
+		int i;
+
+		for (;;) {
+			seq = s->r.seq;
+			asm volatile ("" : : : "memory");
+			if ((seq & 1) == 0) {
+				for (i = 0; i < N; ++i) pos[i] = s->pos[i];
+				asm volatile ("" : : : "memory");
+				if (seq == s->r.seq) break;
+			}
+		}
+	}
+
+	/*!
+	 * \brief ISR cost with all N axes stepping (constant rate, no pin output when built with step == NULL).
+	 * Compare the result of MotionND<1>, <2>, ... to get the cost of every extra axis.
+	 */
+	template<class OUT>
+	void bench(OUT out) {
+		int32_t delta[N];
+		uint32_t t0, cnt;
+		int i;
+
+		if (busy()) return;
+		for (i = 0; i < N; ++i) delta[i] = 2000;
+		st.r.prof_min = 0xffffffff; st.r.prof_max = 0; st.r.prof_sum = 0; st.r.prof_cnt = 0;
+		t0 = GetCycleCount();
+		start(500, delta, true);
+		while (busy()) yield();
+		t0 = GetCycleCount() - t0;
+		cnt = st.r.prof_cnt;
+		out("axes="+String(N) + ",isr_cycles="+String(cnt ? st.r.prof_min : 0) + "/" + String(cnt ? (st.r.prof_sum / cnt) : 0) + "/" + \
+			String(st.r.prof_max) + ",cpu="+String(t0 ? (uint32_t)(((uint64_t)st.r.prof_sum * 1000) / t0) : 0) + "/1000\r\n");
+		for (i = 0; i < N; ++i) st.pos[i] -= delta[i];
+		st.r.pos = st.r.target = 0;
+	}
+
+	/*!
+	 * \brief Step ISR (timer1 callback) for all axes.
+	 */
+	template<bool PROFILE>
+	static __attribute__((optimize("O2"))) ICACHE_RAM_ATTR uint32_t intr_handler(void) {
+		motion_nd_state_t<N> *n = &st;
+		motion_state_t *s = &n->r;
+		uint32_t now = GetCycleCountIRQ();
+		int32_t expiryToGo;
+		int i;
+
+		asm volatile ("" : : : "memory");
+		if (s->active == 0) return 10000;
+		const uint32_t entry = now;
+
+		expiryToGo = (s->time - now);
+		if (expiryToGo <= 0) {
+			motion_write_begin(s);
+			if (s->pulse) {
+				gpio_r->out_w1tc = n->out;
+				s->pulse = 0;
+				if (s->pos == s->target) {
+					s->time    = 0;
+					s->hperiod = 0;
+				}
+#ifdef USE_RAMP
+				else if (s->ramp_phase) {
+					motion_ramp_update(s);
+				}
+#endif
+				s->time += s->hperiod;
+			} else if (s->pos != s->target) {
+				uint32_t o = 0;
+				/* Bresenham: distribute the other axes over the dominant axis steps */
+				for (i = 0; i < N; ++i) {
+					n->err[i] -= n->delta[i];
+					if (n->err[i] < 0) {
+						n->err[i] += n->total;
+						n->pos[i] += n->dir[i];
+						o |= n->mask[i];
+					}
+				}
+				gpio_r->out_w1ts = o;
+				n->out = o;
+				s->time += s->hperiod;
+				s->pulse = 1;
+				s->pos++;
+			} else {
+				s->time = 0;
+			}
+			if (s->time == 0) s->active = 0;
+			motion_write_end(s);
+		}
+		uint32_t d0 = (s->time == 0) ? 10000 : (s->time - now);
+		if (PROFILE) {
+			uint32_t c = GetCycleCountIRQ() - entry;
+			if (c < s->prof_min) s->prof_min = c;
+			if (c > s->prof_max) s->prof_max = c;
+			s->prof_sum += c;
+			s->prof_cnt++;
+		}
+		asm volatile ("" : : : "memory");
+		return d0;
+	}
+protected:
+	/*!
+	 * \brief Prepare and start segment.
+	 */
+	void start(uint16_t duration, const int32_t *delta, bool profile) {
+		motion_state_t *s = &st.r;
+		uint32_t tmp;
+		int32_t total = 0, d;
+		int i;
+
+		if (!m_motorsEnabled && (m_en_pin >= 0) && !profile) motorsOn();
+		setTimer1Callback(NULL);
+		motion_write_begin(s);
+		s->active = 0;
+		s->pulse  = 0;
+		for (i = 0; i < N; ++i) {
+			d = delta[i];
+			if (d < 0) {
+				st.dir[i] = -1;
+				gpio_r->out_w1tc = m_dir_mask[i];
+				d = -d;
+			} else {
+				st.dir[i] = 1;
+				gpio_r->out_w1ts = m_dir_mask[i];
+			}
+			st.delta[i] = d;
+			if (d > total) total = d;
+		}
+		for (i = 0; i < N; ++i) st.err[i] = total >> 1;
+		st.total  = total;
+		s->pos    = 0;
+		s->target = total;
+		tmp = step_period(duration, total);
+#ifdef USE_RAMP
+		s->pos_start  = 0;
+		s->dir        = 1;
+		s->pos_middle = ((total)>>1) - 2;
+		s->ramp_pos   = 0;
+		s->ramp_iter  = 0;
+		s->ramp_phase = 0;
+		if (!profile) {
+			if (tmp < RMAXIMUM_PERIOD) tmp = RMAXIMUM_PERIOD;
+			if (tmp < RSTART_STOP_PERIOD) {
+				s->target_hperiod = RMAXIMUM_HPERIOD;
+				s->ramp_phase     = 1;
+				tmp = RSTART_STOP_PERIOD;
+			}
+		}
+#endif
+		s->hperiod   = (tmp >> 1);
+		m_in_motion  = 1;
+		s->active    = (total != 0);
+		s->time      = (GetCycleCount() + microsecondsToClockCycles(500));
+		motion_write_end(s);
+		if (total) setTimer1Callback(profile ? intr_handler<true> : intr_handler<false>);
+	}
+public:
+	static motion_nd_state_t<N> st;
+	uint32_t       m_dir_mask[N];
+	int            m_en_pin;
+	bool           m_motorsEnabled;
+	volatile int   m_in_motion;
+	segment_t      m_q[MOTION_ND_QUEUE_SIZE];
+	int            m_qWr;
+	int            m_qRd;
+};
+
+template<int N> motion_nd_state_t<N> MotionND<N>::st;
+
+#endif // __MOTION_ND__
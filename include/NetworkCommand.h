@@ -13,42 +13,79 @@
 #include "Command.h"
 #include <ESPAsyncTCP.h>
 
-class NetworkCommand: public Command{
+// Maximum number of TCP sessions (sessions are preallocated)
+#define NET_MAX_CLIENTS (4)
+// Transmit ring of a session (power of 2)
+#define NET_TX_BUFFER   (1024)
+// Send at once when this many bytes are waiting (about one TCP segment), otherwise in loop()
+#define NET_TX_FLUSH    (536)
+
+/*!
+ * \brief One TCP connection: own line buffer, binary mode, sequence and credit state.
+ * Replies of queued commands go back to the session that sent them.
+ * Output is collected in a ring buffer and handed to TCP as the window allows
+ * (once per loop, on ACK, or when NET_TX_FLUSH bytes are waiting). A message
+ * that does not fit into the ring is dropped as a whole (frames stay intact).
+ */
+class NetworkSession: public Command {
 public:
-	NetworkCommand(CommandDB *db, int port):Command(db) {
-		m_client = 0;
-		m_server = new AsyncServer(port);
-		m_server->onClient([](void* arg, AsyncClient* client) {
-			cmddebug("TCP:New client\n");
-			NetworkCommand *p = ((NetworkCommand*)(arg));
-			client->setNoDelay(true);
-			p->m_client = client;
-			client->onDisconnect([](void* arg, AsyncClient* client) {
-				cmddebug("TCP:DisConnect\n");
-				NetworkCommand *p = ((NetworkCommand*)(arg));
-				if (p->m_client == client) p->m_client = 0;
-			}, p);
-			client->onData([](void *narg, AsyncClient* client, void *data, size_t len){((NetworkCommand*)(narg))->handleData((char *)data, (int)len); }, p);
-		}, this);
-		m_server->begin();
-	};      // Constructor
-
-	~NetworkCommand() {
-		delete m_server;
-	}
-
-	virtual void print(String s) {
-		if (m_client) {
-			m_client->add(s.c_str(),s.length());
-			m_client->send();
-		}
-		cmddebug(s);
-	}
-	virtual void readSerial() {};
-	void handleData(char *data, int len);
+	NetworkSession(): Command(NULL), m_client(NULL), m_txHead(0), m_txTail(0), m_txDelivered(0), m_txAcked(0), m_txDropped(0), m_txDroppedMsg(0) {m_binaryCapable = true;}
+
+	void attach(CommandDB *db, AsyncClient *client);
+	void detach();
+	bool active() const {return m_client != NULL;}
+
+	virtual void write(const uint8_t *data, int len);
+	/*!
+	 * \brief Move buffered output to TCP (as much as space() allows).
+	 */
+	void flush();
+	virtual void loop() {flush();}
+	uint32_t txPending() const {return m_txHead - m_txTail;}
 public:
-	AsyncServer    *m_server;
 	AsyncClient    *m_client;
+	uint8_t         m_tx[NET_TX_BUFFER];
+	uint32_t        m_txHead;           // Bytes written into the ring (free running)
+	uint32_t        m_txTail;           // Bytes passed to TCP (free running)
+	uint32_t        m_txDelivered;      // Bytes passed to TCP
+	uint32_t        m_txAcked;          // Bytes acknowledged by the peer
+	uint32_t        m_txDropped;        // Bytes dropped (ring full)
+	uint32_t        m_txDroppedMsg;     // Messages dropped (ring full)
+};
+
+/*!
+ * \brief TCP command server (up to m_maxClients sessions at once).
+ */
+class NetworkCommand {
+public:
+	NetworkCommand(CommandDB *db, int port, int maxClients = 2);
+	~NetworkCommand();
+
+	/*!
+	 * \brief Change client limit (1..NET_MAX_CLIENTS), open sessions above the limit stay until they close.
+	 */
+	bool setMaxClients(int n);
+	int  clients();
+	/*!
+	 * \brief Credit reports of all sessions (see Command::creditTick).
+	 */
+	void creditTick(int credits);
+	/*!
+	 * \brief Flush transmit buffers of all sessions (called from the main loop).
+	 */
+	void loop();
+	/*!
+	 * \brief Session list with transmit counters.
+	 */
+	void printStat(CommandQueueItem *c);
+protected:
+	void onClient(AsyncClient *client);
+public:
+	AsyncServer    *m_server;
+	CommandDB      *m_db;
+	int             m_maxClients;
+	uint32_t        m_rejected;         // Connections refused (limit reached)
+	NetworkSession  m_sessions[NET_MAX_CLIENTS];
 };
 
 #endif //NetworkCommand_h
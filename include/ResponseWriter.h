@@ -0,0 +1,58 @@
+/*
+ * Fixed buffer response writer (replies without String temporaries).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __RESPONSE_WRITER_H__
+#define __RESPONSE_WRITER_H__
+
+#include <stdint.h>
+#include <stdarg.h>
+
+// Size of the reply buffer (on the stack of the writer), longer replies are sent in parts
+#define RESPONSE_BUFFER (256)
+
+class Command;
+class CommandQueueItem;
+
+/*!
+ * \brief Reply builder.
+ * Text is formatted into a stack buffer and handed to the transport with
+ * Command::print(const char *, int) when the buffer is full and when the writer
+ * goes out of scope. A command with a sequence number gets "N<seq> " in front.
+ *
+ *   ResponseWriter w(c);
+ *   w.printf("x_pos=%d\r\n", pos);
+ *   w.ok();
+ */
+class ResponseWriter {
+public:
+	ResponseWriter(Command *c, int32_t seq = -1);
+	ResponseWriter(CommandQueueItem *c);
+	~ResponseWriter() {flush();}
+	ResponseWriter(const ResponseWriter &) = delete;
+	ResponseWriter &operator=(const ResponseWriter &) = delete;
+
+	ResponseWriter &printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+	ResponseWriter &vprintf(const char *fmt, va_list ap);
+	ResponseWriter &add(const char *s);
+	ResponseWriter &add(const char *s, int len);
+	ResponseWriter &ok()                   {return add("OK\r\n", 4);}
+	ResponseWriter &error(const char *txt) {return printf("!8 Err: %s\r\n", txt);}
+	/*!
+	 * \brief Send buffered text now.
+	 */
+	void flush();
+	int  length() const {return m_len;}
+public:
+	Command  *m_cmd;
+	int       m_len;
+	int       m_prefix;     /*!< Length of "N<seq> " at the start of the buffer. */
+	char      m_buf[RESPONSE_BUFFER + 1];
+};
+
+#endif // __RESPONSE_WRITER_H__
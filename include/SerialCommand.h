@@ -0,0 +1,63 @@
+/*
+ * SerialCommand - Execute commands over the UART (wired fallback for TCP).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __SERIALCOMMAND_H__
+#define __SERIALCOMMAND_H__
+
+#include "Command.h"
+
+// UART receive ring (filled by the UART interrupt, 1024 bytes is ~11ms at 921600 baud)
+#define SERIAL_RX_BUFFER  (1024)
+// Transmit ring (power of 2), drained into the 128 byte UART FIFO
+#define SERIAL_TX_BUFFER  (1024)
+// Bytes passed to the line parser at once, at most SERIAL_READ_LOOPS times per loop()
+#define SERIAL_READ_CHUNK (128)
+#define SERIAL_READ_LOOPS (4)
+
+/*!
+ * \brief Command connection on a hardware UART (text lines or binary frames, like a TCP session).
+ * Reception is buffered by the core UART interrupt in a SERIAL_RX_BUFFER ring and
+ * parsed from loop(). Output goes into a transmit ring that is moved into the UART
+ * FIFO without blocking (a message that does not fit is dropped as a whole).
+ * Debug output must not use the same UART (see pdebug in UdpLogger.h).
+ */
+class SerialCommand: public Command {
+public:
+	SerialCommand(CommandDB *db, HardwareSerial &port = Serial): Command(db), m_port(port), m_baud(0),
+		m_txHead(0), m_txTail(0), m_rxBytes(0), m_rxPeak(0), m_rxOverruns(0), m_txDropped(0), m_txDroppedMsg(0) {m_binaryCapable = true;}
+
+	/*!
+	 * \brief Open the port (the receive ring must be sized before begin()).
+	 */
+	void begin(uint32_t baud);
+	/*!
+	 * \brief Parse received data and move output to the UART (called from the main loop).
+	 */
+	virtual void loop();
+	virtual void write(const uint8_t *data, int len);
+	void flush();
+	uint32_t txPending() const {return m_txHead - m_txTail;}
+	/*!
+	 * \brief Port counters and command latency (SER).
+	 */
+	void printStat(ResponseWriter &w);
+public:
+	HardwareSerial &m_port;
+	uint32_t        m_baud;
+	uint8_t         m_tx[SERIAL_TX_BUFFER];
+	uint32_t        m_txHead;           // Bytes written into the ring (free running)
+	uint32_t        m_txTail;           // Bytes passed to the UART (free running)
+	uint32_t        m_rxBytes;          // Bytes received
+	uint32_t        m_rxPeak;           // Most bytes waiting in the receive ring
+	uint32_t        m_rxOverruns;       // Receive ring overflows (data lost)
+	uint32_t        m_txDropped;        // Bytes dropped (ring full)
+	uint32_t        m_txDroppedMsg;     // Messages dropped (ring full)
+};
+
+#endif // __SERIALCOMMAND_H__
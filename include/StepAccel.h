@@ -0,0 +1,39 @@
+/*
+ * AccelStepper step backend (polled from the main loop).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __STEP_ACCEL_H__
+#define __STEP_ACCEL_H__
+
+class AccelStepper;
+
+class StepAccel
+{
+public:
+	StepAccel(): m_xMotor(NULL) {}
+	static const char *name() {return "accelstepper";}
+	template<uint32_t STEP_MASK> static motion_isr_pair_t isr() {return {NULL, NULL};}
+
+	void begin(int step, int dir, const motion_isr_pair_t &isr);
+	bool start(uint16_t duration, int xSteps);
+	bool busy();
+	void halt();
+	void snapshot(motion_snapshot_t *snap);
+	int  position();
+	void setZero();
+	void stat(ResponseWriter &w) {}
+	bool benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r);
+	bool adaptiveMicrosteps(int native, int cruise, bool (*set)(int microsteps)) {return false;}
+	bool feedHold(bool on) {return false;}
+	bool feedOverride(int percent) {return false;}
+	const char *fault() {return NULL;}
+public:
+	AccelStepper *m_xMotor;
+};
+
+#endif // __STEP_ACCEL_H__
@@ -0,0 +1,136 @@
+/*
+ * Step generation backends for Motion1D.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __STEP_BACKEND_H__
+#define __STEP_BACKEND_H__
+
+#include "Arduino.h"
+#include <stdint.h>
+#include "motion_state.h"
+
+class ResponseWriter;
+
+/*
+ * A backend is a compile-time policy used by Motion1D. Every backend provides:
+ *
+ *   static const char *name();
+ *   template<uint32_t STEP_MASK> static motion_isr_pair_t isr(); - step ISR for a fixed STEP pin (if any),
+ *   void begin(int step, int dir, const motion_isr_pair_t &isr); - configure pins,
+ *   bool start(uint16_t duration, int xSteps);                   - start relative move,
+ *   bool busy();                                                 - move in progress (polled backends step here),
+ *   void halt();                                                 - soft stop (target = position),
+ *   void snapshot(motion_snapshot_t *snap);                      - consistent motion state,
+ *   int  position();
+ *   void setZero();
+ *   void stat(ResponseWriter &w);                                - backend specific status lines,
+ *   bool benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r); - constant rate run for stepBench(),
+ *   bool adaptiveMicrosteps(int native, int cruise, bool (*set)(int)); - coarse microsteps at cruise (false - unsupported),
+ *   bool feedHold(bool on);                                      - ramp down and pause the running move / resume (false - unsupported),
+ *   bool feedOverride(int percent);                              - scale the step rate of running moves (false - unsupported),
+ *   const char *fault();                                         - reason the last move was aborted (NULL - none), cleared by the read.
+ */
+
+/*! Minimum step period for normal moves [cycles @ 80MHz] */
+#define MIN_PERIOD        (4000)
+
+/*!
+ * \brief Result of one benchmark run.
+ */
+typedef struct step_bench_s {
+	uint32_t steps;       /*!< Steps generated.                      */
+	uint32_t late_max;    /*!< Worst STEP edge lateness [cycles].    */
+	uint32_t late_sum;    /*!< Sum of STEP edge lateness [cycles].   */
+	uint32_t busy;        /*!< Cycles spent generating steps.        */
+	uint32_t elapsed;     /*!< Run time [cycles].                    */
+} step_bench_t;
+
+static inline ICACHE_RAM_ATTR uint32_t GetCycleCount()
+{
+	uint32_t ccount;
+	__asm__ __volatile__("esync; rsr %0,ccount":"=a"(ccount));
+	return ccount;
+}
+//===========================================================================================
+
+/*!
+ * \brief Step period [cycles] of a move of xSteps in duration [ms].
+ */
+static inline uint32_t step_period(uint16_t duration, int xSteps)
+{
+	uint64_t tmp;
+
+	if (duration == 0) duration = 100;
+	if (xSteps < 0) xSteps = -xSteps;
+	/* Set period (timer1 clock  = 80MHz) */
+	if (xSteps) {
+		tmp = duration;
+		tmp *= 80000;
+		tmp /= xSteps;
+		tmp--;
+	} else {
+		tmp = 160000;
+	}
+	if (tmp < MIN_PERIOD) tmp = MIN_PERIOD;
+	return (tmp & 0xffffffff);
+}
+//===========================================================================================
+
+#include "StepTimer1.h"
+#include "StepAccel.h"
+#include "StepSim.h"
+#include "StepI2S.h"
+
+/*!
+ * \brief Benchmark shared by all backends.
+ * Runs constant rate moves with increasing step rate (motors should be disabled)
+ * and reports edge lateness (jitter) and CPU use. The highest rate where every
+ * step was generated and the worst edge stayed within a quarter of the half
+ * period is reported as the maximum clean step rate.
+ * \param out - called with every report line.
+ */
+template<class B, class OUT>
+void stepBench(B &b, OUT out)
+{
+	step_bench_t r;
+	uint32_t hperiod, steps, rate, best = 0;
+
+	out(String("backend=") + B::name() + "\r\n");
+	for (hperiod = 20000; hperiod >= 100; hperiod = (hperiod * 3) >> 2) {
+		/* ~50 ms per run */
+		steps = 2000000u / hperiod;
+		if (steps > 4000) steps = 4000;
+		memset(&r, 0, sizeof(r));
+		if (!b.benchRun(hperiod, steps, &r)) {
+			out("!8 Err: Backend busy\r\n");
+			return;
+		}
+		rate = 40000000u / hperiod;
+		bool clean = (r.steps == steps) && (r.late_max <= (hperiod >> 2));
+		out("rate="+String(rate) + ",steps="+String(r.steps) + ",late_avg="+String(r.steps ? (r.late_sum / r.steps) : 0) + \
+			",late_max="+String(r.late_max) + ",cpu="+String(r.elapsed ? (uint32_t)(((uint64_t)r.busy * 1000) / r.elapsed) : 0) + "/1000" + \
+			(clean ? "\r\n" : " !\r\n"));
+		if (!clean) break;
+		best = rate;
+		yield();
+	}
+	out("max_clean_rate="+String(best)+"\r\nOK\r\n");
+}
+//===========================================================================================
+
+/*! Step backend used by Motion1D */
+#ifndef MOTION_BACKEND
+#ifdef USE_ACCEL_STEPPER
+#define MOTION_BACKEND StepAccel
+#else
+#define MOTION_BACKEND StepTimer1
+#endif
+#endif
+typedef MOTION_BACKEND MotionBackend;
+
+#endif // __STEP_BACKEND_H__
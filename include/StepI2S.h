@@ -0,0 +1,74 @@
+/*
+ * I2S DMA step backend (hardware clocked STEP edges).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __STEP_I2S_H__
+#define __STEP_I2S_H__
+
+#include "i2s_step_encoder.h"
+
+/*
+ * The planned step sequence is encoded into I2S sample words and clocked out
+ * by the I2S DMA, so WiFi and flash cache stalls do not move STEP edges.
+ * loop() only has to refill the DMA ring before it runs dry.
+ *
+ * Wiring: STEP must be connected to I2S data out - GPIO3 (RX). I2S also drives
+ * BCK on GPIO15 and WS on GPIO2, so the motor enable pin has to be moved off GPIO2.
+ * GPIO3 is UART0 RX, the command UART (SerialCommand) can not be used with it.
+ */
+
+/*! I2S sample rate, bit clock = rate * 32 (96000 -> 3.072MHz, 0.326us per slot) */
+#define I2S_STEP_RATE     (96000)
+/*! STEP high width [slots] (>= 1us for A4988) */
+#define I2S_STEP_PULSE    (4)
+/*! Words encoded at once */
+#define I2S_STEP_CHUNK    (16)
+/*! Zero words written after the last step (one DMA ring) */
+#define I2S_STEP_TAIL     (512)
+
+class StepI2S
+{
+public:
+	StepI2S(): m_encoder(I2S_STEP_PULSE) {}
+	static const char *name() {return "i2s";}
+	template<uint32_t STEP_MASK> static motion_isr_pair_t isr() {return {NULL, NULL};}
+
+	void begin(int step, int dir, const motion_isr_pair_t &isr);
+	bool start(uint16_t duration, int xSteps);
+	bool busy();
+	void halt();
+	void snapshot(motion_snapshot_t *snap);
+	int  position() {return m_st.pos;}
+	void setZero() {m_st.pos = m_st.target = 0;}
+	void stat(ResponseWriter &w);
+	bool benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r);
+	bool adaptiveMicrosteps(int native, int cruise, bool (*set)(int microsteps)) {return false;}
+	bool feedHold(bool on) {return false;}
+	bool feedOverride(int percent) {return false;}
+	const char *fault() {return NULL;}
+
+	/*! Step source for I2SStepEncoder. */
+	bool next(uint32_t *interval);
+protected:
+	void run(bool start);
+	void refill();
+public:
+	I2SStepEncoder m_encoder;
+	motion_state_t m_st;          /*!< Planner state (same ramp as the ISR, extended table). */
+	uint32_t       m_dir_mask;
+	uint32_t       m_slot_q16;    /*!< Slots per cycle (Q16).                                */
+	uint32_t       m_frac;        /*!< Fractional slot carried between steps (Q16).          */
+	uint32_t       m_buf[I2S_STEP_CHUNK];
+	uint32_t       m_bufPos;
+	int32_t        m_tail;        /*!< Zero words still to write, <= 0 - done.               */
+	bool           m_running;
+	uint32_t       m_underrun;    /*!< Refills that found the DMA ring empty.                */
+	step_bench_t  *m_bench;       /*!< Lateness accounting (benchmark).                      */
+};
+
+#endif // __STEP_I2S_H__
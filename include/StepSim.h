@@ -0,0 +1,42 @@
+/*
+ * Simulated step backend (no hardware, position advances with time).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __STEP_SIM_H__
+#define __STEP_SIM_H__
+
+class StepSim
+{
+public:
+	StepSim(): m_pos(0), m_target(0), m_period(0), m_next(0) {}
+	static const char *name() {return "sim";}
+	template<uint32_t STEP_MASK> static motion_isr_pair_t isr() {return {NULL, NULL};}
+
+	void begin(int step, int dir, const motion_isr_pair_t &isr) {m_pos = m_target = 0;}
+	bool start(uint16_t duration, int xSteps);
+	bool busy();
+	void halt() {m_target = m_pos;}
+	void snapshot(motion_snapshot_t *snap);
+	int  position() {return m_pos;}
+	void setZero() {m_pos = m_target = 0;}
+	void stat(ResponseWriter &w) {}
+	bool benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r);
+	bool adaptiveMicrosteps(int native, int cruise, bool (*set)(int microsteps)) {return false;}
+	bool feedHold(bool on) {return false;}
+	bool feedOverride(int percent) {return false;}
+	const char *fault() {return NULL;}
+protected:
+	uint32_t run(step_bench_t *r);
+public:
+	int32_t  m_pos;
+	int32_t  m_target;
+	uint32_t m_period;     /*!< Step period [cycles].      */
+	uint32_t m_next;       /*!< Next step time (ccount).   */
+};
+
+#endif // __STEP_SIM_H__
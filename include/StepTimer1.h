@@ -0,0 +1,51 @@
+/*
+ * Timer1 ISR step backend (fast, tabled ramp).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __STEP_TIMER1_H__
+#define __STEP_TIMER1_H__
+
+#include "motion_isr.h"
+
+class StepTimer1
+{
+public:
+	static const char *name() {return "timer1";}
+	template<uint32_t STEP_MASK> static motion_isr_pair_t isr() {return motion_isr_for<STEP_MASK>();}
+
+	void begin(int step, int dir, const motion_isr_pair_t &isr);
+	bool start(uint16_t duration, int xSteps);
+	bool busy();
+	void halt();
+	bool feedHold(bool on);
+	bool feedOverride(int percent);
+	void snapshot(motion_snapshot_t *snap);
+	int  position() {return MX->pos;}
+	void setZero();
+	void stat(ResponseWriter &w);
+	bool benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r);
+	bool adaptiveMicrosteps(int native, int cruise, bool (*set)(int microsteps));
+	/*! Reason of the last aborted move (NULL - none), cleared by the read. */
+	const char *fault() {const char *f = m_fault; m_fault = NULL; return f;}
+protected:
+	void resetProfile();
+	bool switchMicrosteps(bool coarse);
+public:
+	uint32_t          m_dir_mask;
+	motion_isr_pair_t m_isr;
+	volatile int      m_in_motion;
+	/* Adaptive microstepping */
+	bool            (*m_setMicrosteps)(int microsteps);
+	int               m_nativeMicrosteps;
+	int               m_cruiseMicrosteps;
+	uint32_t          m_ustepSwitches;
+	uint32_t          m_ustepErrors;
+	const char       *m_fault;
+};
+
+#endif // __STEP_TIMER1_H__
@@ -0,0 +1,140 @@
+/*
+ * TMC2208 stepper driver configuration over the single wire PDN_UART.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __TMC2208_H__
+#define __TMC2208_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Registers */
+#define TMC2208_GCONF       (0x00)
+#define TMC2208_GSTAT       (0x01)
+#define TMC2208_IFCNT       (0x02)
+#define TMC2208_MSCNT       (0x6A)
+#define TMC2208_CHOPCONF    (0x6C)
+
+/* GCONF bits */
+#define TMC2208_GCONF_I_SCALE_ANALOG   (1 << 0)
+#define TMC2208_GCONF_PDN_DISABLE      (1 << 6)
+#define TMC2208_GCONF_MSTEP_REG_SELECT (1 << 7)
+#define TMC2208_GCONF_MULTISTEP_FILT   (1 << 8)
+
+/* CHOPCONF */
+#define TMC2208_CHOPCONF_DEFAULT       (0x10000053)   /* intpol=1, toff=3, hstrt=5 */
+#define TMC2208_CHOPCONF_MRES_SHIFT    (24)
+#define TMC2208_CHOPCONF_MRES_MASK     (0x0f << TMC2208_CHOPCONF_MRES_SHIFT)
+
+/*!
+ * \brief Byte transport to PDN_UART (real serial port or a mock).
+ * The line is single wire. Whether written bytes come back (echo) depends on the
+ * port: a HardwareSerial with TX joined to RX over a resistor receives them,
+ * SoftwareSerial in one wire mode turns RX off while sending and does not.
+ */
+class TMC2208Uart {
+public:
+	virtual ~TMC2208Uart() {}
+	/*! Write bytes, return when they are on the wire. */
+	virtual size_t write(const uint8_t *data, size_t len) = 0;
+	/*! Read one byte, -1 - nothing received within timeout. */
+	virtual int read(uint32_t timeoutMs) = 0;
+	/*! Drop received bytes. */
+	virtual void clear() = 0;
+	/*! Written bytes are received back. */
+	virtual bool echo() const = 0;
+};
+
+/*!
+ * \brief TMC2208 register access.
+ */
+class TMC2208 {
+public:
+	TMC2208(TMC2208Uart *uart, uint8_t slave = 0): m_uart(uart), m_slave(slave), m_chopconf(TMC2208_CHOPCONF_DEFAULT), m_microsteps(0), m_errors(0) {}
+
+	/*!
+	 * \brief Take configuration from registers instead of PDN/MS pins.
+	 * \return true when the driver answered.
+	 */
+	bool begin(int microsteps);
+	/*!
+	 * \brief Set microstep resolution (1, 2, 4 ... 256).
+	 */
+	bool setMicrosteps(int microsteps);
+	int  microsteps() const {return m_microsteps;}
+
+	/*!
+	 * \brief Write register, true only when IFCNT shows the driver took the datagram.
+	 */
+	bool writeRegister(uint8_t reg, uint32_t value);
+	bool readRegister(uint8_t reg, uint32_t *value);
+	bool sendWrite(uint8_t reg, uint32_t value);
+
+	static uint8_t crc(const uint8_t *data, size_t len);
+	static int     mres(int microsteps);
+public:
+	TMC2208Uart *m_uart;
+	uint8_t      m_slave;
+	uint32_t     m_chopconf;     /*!< Last written CHOPCONF.          */
+	int          m_microsteps;   /*!< Current microstep resolution.   */
+	uint32_t     m_errors;       /*!< Failed transfers.               */
+};
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+/*!
+ * \brief TMC2208Uart on an Arduino Stream (Serial with TX and RX joined by a resistor, ...).
+ */
+class TMC2208StreamUart: public TMC2208Uart {
+public:
+	TMC2208StreamUart(Stream *s, bool echo = true): m_stream(s), m_echo(echo) {}
+	virtual size_t write(const uint8_t *data, size_t len) {
+		size_t n = m_stream->write(data, len);
+		m_stream->flush();
+		return n;
+	}
+	virtual int read(uint32_t timeoutMs) {
+		uint32_t t0 = millis();
+		while (!m_stream->available()) {
+			if ((millis() - t0) >= timeoutMs) return -1;
+			yield();
+		}
+		return m_stream->read();
+	}
+	virtual void clear() {
+		while (m_stream->available()) m_stream->read();
+	}
+	virtual bool echo() const {return m_echo;}
+public:
+	Stream *m_stream;
+	bool    m_echo;
+};
+
+#include <SoftwareSerial.h>
+
+/*!
+ * \brief TMC2208Uart on SoftwareSerial with RX and TX on the same pin (PDN_UART).
+ * enableTx(true) switches the pin to output, so there is no echo.
+ */
+class TMC2208SoftUart: public TMC2208StreamUart {
+public:
+	TMC2208SoftUart(SoftwareSerial *s): TMC2208StreamUart(s, false), m_serial(s) {}
+	virtual size_t write(const uint8_t *data, size_t len) {
+		size_t n;
+		m_serial->enableTx(true);
+		n = TMC2208StreamUart::write(data, len);
+		m_serial->enableTx(false);
+		return n;
+	}
+public:
+	SoftwareSerial *m_serial;
+};
+#endif
+
+#endif // __TMC2208_H__
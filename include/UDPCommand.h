@@ -0,0 +1,108 @@
+/*
+ * UDPCommand - Execute commands sent in UDP datagrams (sequence numbers, ACK).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __UDPCOMMAND_H__
+#define __UDPCOMMAND_H__
+
+#include "Command.h"
+#include <ESPAsyncUDP.h>
+
+// Senders (ip:port) served at once
+#define UDP_MAX_PEERS    (2)
+// Reply datagram payload (fits into one ethernet frame)
+#define UDP_TX_BUFFER    (512)
+// Sequence numbers remembered below the highest one (duplicate detection, max 32)
+#define UDP_SEQ_WINDOW   (32)
+// A sequence number this far below the highest one restarts the numbering
+#define UDP_SEQ_RESTART  (1024)
+// Peer slot can be taken over by a new sender after this idle time [ms]
+#define UDP_PEER_TIMEOUT (10000)
+
+/*!
+ * \brief One UDP sender: line parser, duplicate filter and reply datagram.
+ * Replies are collected and sent as one datagram (at the end of a received
+ * datagram, in loop(), or when UDP_TX_BUFFER is full).
+ */
+class UDPPeer: public Command {
+public:
+	UDPPeer(): Command(NULL), m_udp(NULL), m_ip(0), m_port(0), m_last(0), m_seqHigh(-1), m_seqMask(0),
+		m_txLen(0), m_datagrams(0), m_dups(0), m_txDatagrams(0) {}
+
+	void attach(CommandDB *db, AsyncUDP *udp, uint32_t ip, uint16_t port);
+	void detach();
+	bool active() const {return m_udp != NULL;}
+	bool is(uint32_t ip, uint16_t port) const {return active() && (m_ip == ip) && (m_port == port);}
+	/*!
+	 * \brief Duplicate filter (true - already executed, or too old to tell).
+	 */
+	bool seen(int32_t seq) const;
+	/*!
+	 * \brief Remember sequence number as executed (after the command was queued).
+	 */
+	void mark(int32_t seq);
+
+	virtual void write(const uint8_t *data, int len);
+	/*!
+	 * \brief Send collected replies.
+	 */
+	void flush();
+	virtual void loop() {flush();}
+public:
+	AsyncUDP  *m_udp;
+	uint32_t   m_ip;
+	uint16_t   m_port;
+	uint32_t   m_last;                      // Last datagram [ms]
+	int32_t    m_seqHigh;                   // Highest sequence number seen (-1 - none)
+	uint32_t   m_seqMask;                   // Bit n - m_seqHigh - n seen
+	uint8_t    m_tx[UDP_TX_BUFFER];
+	int        m_txLen;
+	uint32_t   m_datagrams;                 // Datagrams received
+	uint32_t   m_dups;                      // Duplicate commands (not executed)
+	uint32_t   m_txDatagrams;               // Datagrams sent
+};
+
+/*!
+ * \brief UDP command endpoint.
+ *
+ * A datagram carries one or more lines ("\n" or "\r" separated). A line with a
+ * sequence number "N<seq> CMD,args" is acknowledged with "ACK,<seq>" in the
+ * reply datagram of the request, the command result follows as "N<seq> OK"
+ * (queued commands: when executed). A command rejected with "Command queue
+ * full" gets no ACK and is not remembered, so its retransmit is executed. A
+ * repeated sequence number is not executed again, it gets "ACK,<seq>,dup" -
+ * the sender retransmits until it has an ACK.
+ * Lines without a sequence number are executed without ACK or duplicate check.
+ */
+class UDPCommand {
+public:
+	UDPCommand(CommandDB *db, uint16_t port);
+
+	/*!
+	 * \brief Send collected replies of all peers (called from the main loop).
+	 */
+	void loop();
+	void creditTick(int credits);
+	/*!
+	 * \brief Endpoint and peer counters (UDP).
+	 */
+	void printStat(CommandQueueItem *c);
+protected:
+	void onPacket(AsyncUDPPacket &packet);
+	UDPPeer *peer(uint32_t ip, uint16_t port);
+	void executeLine(UDPPeer *p, const char *line, int len);
+public:
+	AsyncUDP   m_udp;
+	CommandDB *m_db;
+	uint16_t   m_port;
+	uint32_t   m_datagrams;                 // Datagrams received
+	uint32_t   m_rejected;                  // Datagrams dropped (no free peer slot)
+	UDPPeer    m_peers[UDP_MAX_PEERS];
+};
+
+#endif // __UDPCOMMAND_H__
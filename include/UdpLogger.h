@@ -9,10 +9,11 @@
 #define pwrite(fmt, len)
 #else
 #define DEBUG_ENABLED
-//#define pdebug(fmt, args...) UdpLogger.printf(fmt, ## args)
-//#define pwrite(fmt, len) UdpLogger.print(fmt);
-#define pdebug(fmt, args...) Serial.printf(fmt, ## args)
-#define pwrite(fmt, len) Serial.write(fmt, len)
+/* Not on Serial: the UART carries commands (SerialCommand) */
+#define pdebug(fmt, args...) UdpLogger.printf(fmt, ## args)
+#define pwrite(fmt, len) UdpLogger.print(fmt);
+//#define pdebug(fmt, args...) Serial.printf(fmt, ## args)
+//#define pwrite(fmt, len) Serial.write(fmt, len)
 #endif
 
 
@@ -0,0 +1,87 @@
+/*
+ * WebSocketCommand - Execute commands over a WebSocket (web UI), telemetry push.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __WEBSOCKETCOMMAND_H__
+#define __WEBSOCKETCOMMAND_H__
+
+#include "Command.h"
+#include <ESPAsyncWebServer.h>
+
+// WebSocket clients served at once (sessions are preallocated)
+#define WS_MAX_CLIENTS  (2)
+// Output collected per client and sent as one WebSocket message per loop
+#define WS_TX_BUFFER    (512)
+// Telemetry period [ms]
+#define WS_TELEMETRY    (250)
+
+/*!
+ * \brief Telemetry line (status of the machine), sent to every client each WS_TELEMETRY ms.
+ */
+typedef Delegate<void(ResponseWriter &w)> TelemetryCB;
+
+/*!
+ * \brief One WebSocket client: own line buffer, sequence and credit state.
+ */
+class WebSocketSession: public Command {
+public:
+	WebSocketSession(): Command(NULL), m_client(NULL), m_txLen(0), m_txMessages(0), m_txDropped(0) {}
+
+	void attach(CommandDB *db, AsyncWebSocketClient *client);
+	void detach();
+	bool active() const {return m_client != NULL;}
+
+	virtual void write(const uint8_t *data, int len);
+	/*!
+	 * \brief Send collected output as one text message.
+	 */
+	void flush();
+	virtual void loop() {flush();}
+public:
+	AsyncWebSocketClient *m_client;
+	char      m_tx[WS_TX_BUFFER];
+	int       m_txLen;
+	uint32_t  m_txMessages;                 // Messages sent
+	uint32_t  m_txDropped;                  // Bytes dropped (client queue full)
+};
+
+/*!
+ * \brief WebSocket endpoint on the web server (/ws).
+ * A text message holds one or more command lines, a line can span messages
+ * (the end of a message ends the line). Replies and the telemetry line come
+ * over the same connection, no request per command and no SSE stream.
+ */
+class WebSocketCommand {
+public:
+	WebSocketCommand(CommandDB *db, AsyncWebServer *server, const char *url = "/ws");
+
+	void setTelemetry(TelemetryCB cb, uint32_t interval = WS_TELEMETRY) {m_telemetry = cb; m_interval = interval;}
+	int  clients();
+	/*!
+	 * \brief Telemetry and output of all clients (called from the main loop).
+	 */
+	void loop();
+	void creditTick(int credits);
+	/*!
+	 * \brief Client list with counters (WS).
+	 */
+	void printStat(CommandQueueItem *c);
+protected:
+	void onEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
+	WebSocketSession *session(AsyncWebSocketClient *client);
+public:
+	AsyncWebSocket   *m_ws;
+	CommandDB        *m_db;
+	TelemetryCB       m_telemetry;
+	uint32_t          m_interval;
+	uint32_t          m_last;               // Last telemetry [ms]
+	uint32_t          m_rejected;           // Connections refused (limit reached)
+	WebSocketSession  m_sessions[WS_MAX_CLIENTS];
+};
+
+#endif // __WEBSOCKETCOMMAND_H__
@@ -1,3 +1,7 @@
+#ifndef __ESP8266_GPIO_DIRECT_H__
+#define __ESP8266_GPIO_DIRECT_H__
+
+#include <stdint.h>
 
 struct gpio_regs {
 	uint32_t out;         /* 0x60000300 */
@@ -13,3 +17,5 @@ struct gpio_regs {
 };
 
 static struct gpio_regs* gpio_r = (struct gpio_regs*)(0x60000300);
+
+#endif // __ESP8266_GPIO_DIRECT_H__
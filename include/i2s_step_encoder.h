@@ -0,0 +1,128 @@
+/*
+ * Encode step sequences into I2S sample words (and back).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __I2S_STEP_ENCODER_H__
+#define __I2S_STEP_ENCODER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Every I2S bit clock is one time slot. A 32-bit sample word holds 32 slots,
+ * most significant bit first (the order i2s_write_sample() shifts them out).
+ * STEP is high for m_pulse slots from every rising edge.
+ *
+ * Nothing here depends on the Arduino core, so buffers can be encoded and
+ * decoded back into edge slots on a PC.
+ */
+
+/*!
+ * \brief Step sequence to I2S words encoder.
+ */
+class I2SStepEncoder {
+public:
+	I2SStepEncoder(uint32_t pulse = 4): m_pulse(pulse) {reset();}
+
+	void reset() {
+		m_prev    = 0;
+		m_next    = 0;
+		m_pending = false;
+		m_high    = 0;
+	}
+
+	/*! No edge pending and STEP is low at the end of the last buffer. */
+	bool idle() const {return (!m_pending) && (m_high == 0);}
+
+	/*!
+	 * \brief Fill buffer with the next words of the STEP waveform.
+	 * \param src - step source, bool next(uint32_t *interval) returns the slot
+	 *              distance from the previous rising edge to the next one,
+	 *              false when there are no more steps.
+	 * \return number of rising edges encoded.
+	 */
+	template<class SRC>
+	uint32_t encode(uint32_t *buf, uint32_t words, SRC &src) {
+		const int32_t total = words * 32;
+		uint32_t steps = 0, n;
+
+		memset(buf, 0, words * 4);
+		/* High slots carried over from the previous buffer */
+		n = (m_high < (uint32_t)total) ? m_high : total;
+		setBits(buf, 0, n);
+		m_high -= n;
+		for (;;) {
+			if (!m_pending) {
+				uint32_t iv;
+				if (!src.next(&iv)) break;
+				/* Keep STEP low for at least one slot */
+				if (iv <= m_pulse) iv = m_pulse + 1;
+				m_next    = m_prev + (int32_t)iv;
+				m_pending = true;
+			}
+			if (m_next >= total) break;
+			n = ((uint32_t)(total - m_next) < m_pulse) ? (uint32_t)(total - m_next) : m_pulse;
+			setBits(buf, m_next, n);
+			m_high    = m_pulse - n;
+			m_prev    = m_next;
+			m_pending = false;
+			steps++;
+		}
+		/* Make positions relative to the next buffer */
+		m_prev -= total;
+		if (m_pending) m_next -= total;
+		return steps;
+	}
+protected:
+	static void setBits(uint32_t *buf, uint32_t slot, uint32_t n) {
+		while (n--) {
+			buf[slot >> 5] |= (0x80000000u >> (slot & 31));
+			slot++;
+		}
+	}
+public:
+	uint32_t m_pulse;     /*!< STEP high width [slots].                              */
+	int32_t  m_prev;      /*!< Previous rising edge (relative to the buffer start).  */
+	int32_t  m_next;      /*!< Next rising edge (valid when m_pending).              */
+	bool     m_pending;   /*!< Next edge taken from the source, not yet encoded.     */
+	uint32_t m_high;      /*!< High slots to carry over to the next buffer.          */
+};
+
+/*!
+ * \brief I2S words to rising edge slots decoder (verification).
+ */
+class I2SStepDecoder {
+public:
+	I2SStepDecoder() {reset();}
+	void reset() {m_slot = 0; m_level = false;}
+
+	/*!
+	 * \brief Decode consecutive buffers.
+	 * \param edges - filled with absolute slot numbers of rising edges,
+	 * \return number of edges stored (at most max).
+	 */
+	uint32_t decode(const uint32_t *buf, uint32_t words, uint32_t *edges, uint32_t max) {
+		uint32_t i, b, n = 0;
+
+		for (i = 0; i < words; ++i) {
+			uint32_t w = buf[i];
+			for (b = 0; b < 32; ++b) {
+				bool level = (w & (0x80000000u >> b)) != 0;
+				if (level && !m_level && (n < max)) edges[n++] = m_slot;
+				m_level = level;
+				m_slot++;
+			}
+		}
+		return n;
+	}
+public:
+	uint32_t m_slot;
+	bool     m_level;
+};
+
+#endif // __I2S_STEP_ENCODER_H__
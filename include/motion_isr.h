@@ -0,0 +1,137 @@
+/*
+ * Timer1 step ISR for ESP8266.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __MOTION_ISR_H__
+#define __MOTION_ISR_H__
+
+#include "Arduino.h"
+#include "motion_state.h"
+#include "esp8266_gpio_direct.h"
+
+// Normally would not want two copies like this, but due to different
+// optimization levels the inline attribute gets lost if we try the
+// other version.
+static inline ICACHE_RAM_ATTR uint32_t GetCycleCountIRQ()
+{
+	uint32_t ccount;
+	__asm__ __volatile__("rsr %0,ccount":"=a"(ccount));
+	return ccount;
+}
+//===========================================================================================
+
+/*!
+ * \brief Step ISR (timer1 callback).
+ * STEP_MASK is the STEP gpio mask known at compile time, so the pin write is an
+ * immediate (movi/s32i) instead of a load. STEP_MASK == 0 selects the runtime
+ * mask stored in motion_state_t::step_mask.
+ * PROFILE adds run time and STEP edge lateness accounting (benchmark, XX).
+ *
+ * Work per call besides the seqlock increments:
+ *   falling edge - pin clear, end check, ramp update and ustep check (while
+ *                  ramping), hold check, motion_period();
+ *   rising edge  - pause check (ustep_state, hold), pin set, motion_period(),
+ *                  pos += 1 << ushift.
+ * motion_period() is a shift at 100% feed, a Q8 multiply otherwise.
+ * Cycles are measured on the board: build with -DMOTION_ISR_PROFILE, run BM
+ * (constant rate, no ramp) and a ramped move, then read isr_cycles=min/avg/max
+ * from XX. Compare builds of two commits at the same rate.
+ */
+template<uint32_t STEP_MASK, bool PROFILE>
+__attribute__((optimize("O2"))) ICACHE_RAM_ATTR uint32_t motion_intr_handler(void)
+{
+	motion_state_t *s = &mx;
+	const uint32_t mask = STEP_MASK ? STEP_MASK : s->step_mask;
+	uint32_t now = GetCycleCountIRQ();
+	int32_t expiryToGo;
+
+	asm volatile ("" : : : "memory");
+	if (s->active == 0) return 10000;
+	const uint32_t entry = now;
+
+	/* Process move */
+	expiryToGo = (s->time - now);
+	if (expiryToGo <= 0) {
+		motion_write_begin(s);
+		if (s->pulse) {
+			gpio_r->out_w1tc = mask;
+			s->pulse = 0;
+			if (s->pos == s->target) {
+				/* Disable timer */
+				s->time    = 0;
+				s->hperiod = 0;
+			} else {
+#ifdef USE_RAMP
+				if (s->ramp_phase) {
+					motion_ramp_update(s);
+					if (s->ustep_cruise) motion_ustep_check(s);
+				}
+#endif
+				if (s->hold) motion_hold_update(s);
+			}
+			s->time += motion_period(s);
+		} else if (s->pos != s->target) {
+			if ((s->ustep_state & 1) || (s->hold == 2)) {
+				/* Paused while the loop changes the driver resolution, or feed hold */
+				s->time = now + s->hperiod;
+			} else {
+				gpio_r->out_w1ts = mask;
+				if (PROFILE) {
+					uint32_t late = (uint32_t)(-expiryToGo);
+					if (late > s->late_max) s->late_max = late;
+					s->late_sum += late;
+					s->late_cnt++;
+				}
+				s->time += motion_period(s);
+				s->pulse = 1;
+				if (s->pos > s->target) s->pos -= (1 << s->ushift); else s->pos += (1 << s->ushift);
+			}
+		} else {
+			s->time = 0;
+		}
+		if (s->time == 0) {
+			/* We are done :-) */
+			s->active = 0;
+		}
+		motion_write_end(s);
+	}
+
+	/* calculate next event time */
+	uint32_t d0;
+	if (s->time == 0) {
+		d0 = 10000;
+	} else {
+		d0 = s->time - now;
+	}
+	if (PROFILE) {
+		uint32_t c = GetCycleCountIRQ() - entry;
+		if (c < s->prof_min) s->prof_min = c;
+		if (c > s->prof_max) s->prof_max = c;
+		s->prof_sum += c;
+		s->prof_cnt++;
+	}
+	asm volatile ("" : : : "memory");
+	return d0;
+}
+//===========================================================================================
+
+/*!
+ * \brief ISR pair for one STEP pin (0 - runtime mask).
+ */
+template<uint32_t STEP_MASK>
+static inline motion_isr_pair_t motion_isr_for()
+{
+#ifdef MOTION_ISR_PROFILE
+	return { motion_intr_handler<STEP_MASK, true>, motion_intr_handler<STEP_MASK, true> };
+#else
+	return { motion_intr_handler<STEP_MASK, false>, motion_intr_handler<STEP_MASK, true> };
+#endif
+}
+//===========================================================================================
+
+#endif // __MOTION_ISR_H__
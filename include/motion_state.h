@@ -0,0 +1,240 @@
+/*
+ * Motion state shared between the step ISR and the main loop.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __MOTION_STATE_H__
+#define __MOTION_STATE_H__
+
+#include <stdint.h>
+#include "ramp.h"
+
+/*!
+ * \brief Step ISR state.
+ * All variables used by the ISR are packed into one aligned structure, so the
+ * handler loads a single base address from the literal pool and reaches every
+ * field with an immediate offset (l32i/s32i) instead of one literal per global.
+ * Hot fields go first.
+ */
+typedef struct motion_state_s {
+	int32_t           active;          /*!< ISR is generating steps.                          */
+	uint32_t          seq;             /*!< Sequence counter (odd while being updated).       */
+	uint32_t          time;            /*!< Next event time (ccount).                         */
+	uint32_t          hperiod;         /*!< Current half period (ccount).                     */
+	int32_t           pos;             /*!< Current position [microsteps].                    */
+	int32_t           target;          /*!< Target position [microsteps].                     */
+	int32_t           pulse;           /*!< STEP pin is high.                                 */
+	uint32_t          step_mask;       /*!< STEP gpio mask (runtime pin variant only).        */
+	uint32_t          ushift;          /*!< One step moves (1 << ushift) microsteps.          */
+	int32_t           hold;            /*!< Feed hold: 0 - run, 1 - ramping down, 2 - held.   */
+	uint32_t          period_q8;       /*!< Feed override as period multiplier (Q8, 256 - 1x). */
+	int32_t           ustep_state;     /*!< 0 - native, 1 - pause before coarse, 2 - coarse,  */
+	                                   /*!< 3 - pause before native resolution.               */
+	uint32_t          ustep_cruise;    /*!< Cruise ushift, 0 - adaptive microstepping off.    */
+	int32_t           align_off;       /*!< Offset of pos to the driver microstep table.      */
+#ifdef USE_RAMP
+	int32_t           ramp_phase;      /*!< Current ramp phase.                               */
+	int32_t           ramp_iter;       /*!< Current iterations.                               */
+	int32_t           ramp_pos;        /*!< Current ramp table index.                         */
+	uint32_t          target_hperiod;  /*!< Target half period.                               */
+	int32_t           dir;             /*!< Motion direction.                                 */
+	int32_t           pos_start;       /*!< Motion start position.                            */
+	int32_t           pos_middle;      /*!< Motion middle point.                              */
+	int32_t           ramp_len;        /*!< Motion ramp length.                               */
+#endif
+	/* Profiling ISR variant only */
+	uint32_t          prof_min;        /*!< Shortest ISR run [cycles].                        */
+	uint32_t          prof_max;        /*!< Longest ISR run [cycles].                         */
+	uint32_t          prof_sum;        /*!< Sum of ISR runs [cycles].                         */
+	uint32_t          prof_cnt;        /*!< Number of ISR runs.                               */
+	uint32_t          late_max;        /*!< Worst STEP edge lateness [cycles].                */
+	uint32_t          late_sum;        /*!< Sum of STEP edge lateness [cycles].               */
+	uint32_t          late_cnt;        /*!< Number of STEP edges.                             */
+} __attribute__((aligned(16))) motion_state_t;
+
+/*! Timer1 callback. */
+typedef uint32_t (*motion_isr_fn)(void);
+
+/*! Step ISR instantiated for one STEP pin: normal and profiling variant. */
+typedef struct motion_isr_pair_s {
+	motion_isr_fn     run;
+	motion_isr_fn     profile;
+} motion_isr_pair_t;
+
+/*! ISR state (defined in Motion1D.cpp). The ISR uses it directly, the main loop through MX. */
+extern motion_state_t mx;
+#define MX ((volatile motion_state_t *)&mx)
+
+/*!
+ * \brief Seqlock write side.
+ * Every writer brackets its update with begin/end, readers retry when the counter
+ * moved or is odd. Writers are the ISR, the main loop with the timer stopped, and
+ * the main loop with interrupts masked (motion_irq_lock) while the timer runs -
+ * the seqlock alone does not keep the ISR from stepping between a read and a write.
+ */
+#define motion_irq_lock()      xt_rsil(15)
+#define motion_irq_unlock(ps)  xt_wsr_ps(ps)
+
+static inline __attribute__((always_inline)) void motion_write_begin(motion_state_t *s)
+{
+	s->seq++;
+	asm volatile ("" : : : "memory");
+}
+
+static inline __attribute__((always_inline)) void motion_write_end(motion_state_t *s)
+{
+	asm volatile ("" : : : "memory");
+	s->seq++;
+}
+
+/*!
+ * \brief Consistent copy of the motion state (see Motion1D::snapshot).
+ */
+typedef struct motion_snapshot_s {
+	int32_t           pos;             /*!< Current position [microsteps].                    */
+	int32_t           target;          /*!< Target position [microsteps].                     */
+	uint32_t          hperiod;         /*!< Current half period (ccount), 0 - idle.           */
+	uint32_t          speed;           /*!< Current speed [microsteps/s].                     */
+	int32_t           phase;           /*!< 0 - constant speed, 1 - ramp up/cruise, 2 - down. */
+	int32_t           active;          /*!< ISR is generating steps.                          */
+	int32_t           in_motion;       /*!< Move started and not yet collected by loop().     */
+	int32_t           queue;           /*!< Motion queue depth.                               */
+	uint32_t          retries;         /*!< Number of times the read was repeated.            */
+} motion_snapshot_t;
+
+/* Feed override range [%] */
+#define MOTION_OVERRIDE_MIN (10)
+#define MOTION_OVERRIDE_MAX (200)
+
+/*!
+ * \brief Half period of the next edge with the feed override applied (32-bit math only).
+ * Above 100% a move is never made faster than planned past the start/stop speed, so
+ * ramps keep their limits and only slow constant speed moves are sped up.
+ */
+static inline __attribute__((always_inline)) uint32_t motion_period(const motion_state_t *s)
+{
+	uint32_t h = s->hperiod, k = s->period_q8, p;
+
+	if (k == 256) return h << s->ushift;
+	p = (h >> 8) * k + (((h & 0xff) * k) >> 8);
+	if (k < 256) {
+		uint32_t f = (h < RSTART_STOP_HPERIOD) ? h : RSTART_STOP_HPERIOD;
+		if (p < f) p = f;
+	}
+	return p << s->ushift;
+}
+
+/*!
+ * \brief Feed hold (called after the ramp update): ramp down, held at start/stop speed
+ * (without USE_RAMP the move pauses at the next step).
+ */
+static inline __attribute__((always_inline)) void motion_hold_update(motion_state_t *s)
+{
+	if (s->hold == 1) {
+#ifdef USE_RAMP
+		if (s->ramp_phase == 1) s->ramp_phase = 2;
+		if (s->hperiod >= RSTART_STOP_HPERIOD) s->hold = 2;
+#else
+		/* No ramp to slow down with, stop at once */
+		s->hold = 2;
+#endif
+	}
+}
+
+#ifdef USE_RAMP
+#define RAMP_LEN ((int32_t)sizeof(ramp))
+
+/*!
+ * \brief Update the half period after a step (tabled ramp implementation).
+ * Called from the step ISR after the falling edge.
+ * EXTEND lets the ramp continue past the end of the table (last entry repeats,
+ * index is clamped), so planners running outside the ISR may go faster than RMAXIMUM.
+ */
+template<bool EXTEND>
+static inline __attribute__((always_inline)) uint32_t motion_ramp_entry(int32_t i)
+{
+	if (EXTEND) {
+		if (i < 0) i = 0;
+		if (i >= RAMP_LEN) i = RAMP_LEN - 1;
+	}
+	return ramp[i];
+}
+
+template<bool EXTEND>
+static inline __attribute__((always_inline)) void motion_ramp_update_t(motion_state_t *s)
+{
+	if (s->ramp_phase == 1) {
+		/* Ramp UP */
+		if (s->hperiod > s->target_hperiod) {
+			if (s->ramp_iter == 0) {
+				s->hperiod--;
+				s->ramp_iter = motion_ramp_entry<EXTEND>(s->ramp_pos++);
+				/* Recalculate middle point */
+				if (s->hperiod == s->target_hperiod) {
+					if (s->dir == 1) {
+						s->ramp_len   = s->pos - s->pos_start;
+						s->pos_middle = s->target - s->ramp_len;
+					} else {
+						s->ramp_len   = s->pos_start - s->pos;
+						s->pos_middle = s->target + s->ramp_len;
+					}
+				}
+			} else {
+				s->ramp_iter--;
+			}
+		}
+		/* Check middle point */
+		if (s->dir == 1) {
+			if (s->pos > s->pos_middle) {s->ramp_phase = 2;}
+		} else {
+			if (s->pos < s->pos_middle) {s->ramp_phase = 2;}
+		}
+	} else {
+		/* Ramp DOWN */
+		if (s->hperiod < RSTART_STOP_HPERIOD) {
+			if (s->ramp_iter == 0) {
+				s->hperiod++;
+				s->ramp_iter = motion_ramp_entry<EXTEND>(s->ramp_pos--);
+			} else {
+				s->ramp_iter--;
+			}
+		}
+	}
+}
+
+static inline __attribute__((always_inline)) void motion_ramp_update(motion_state_t *s)
+{
+	motion_ramp_update_t<false>(s);
+}
+
+/*!
+ * \brief Adaptive microstepping state change (called after the ramp update).
+ * Coarse steps are requested at cruise speed on a position aligned to the coarse
+ * grid, native resolution is requested again before the ramp down starts.
+ * The ISR pauses (states 1 and 3) until the loop has reprogrammed the driver,
+ * a failed switch back to native ends the move (StepTimer1::switchMicrosteps()).
+ */
+static inline __attribute__((always_inline)) void motion_ustep_check(motion_state_t *s)
+{
+	int32_t rem   = s->target - s->pos;
+	int32_t scale = 1 << s->ustep_cruise;
+
+	if (rem < 0) rem = -rem;
+	if (s->ustep_state == 0) {
+		if ((s->ramp_phase == 1) && (s->hperiod == s->target_hperiod) && \
+			(((s->pos + s->align_off) & (scale - 1)) == 0) && (rem > (s->ramp_len + (scale << 2)))) {
+			s->ustep_state = 1;
+		}
+	} else if (s->ustep_state == 2) {
+		if ((s->ramp_phase != 1) || (rem <= (s->ramp_len + (scale << 1)))) {
+			s->ustep_state = 3;
+		}
+	}
+}
+#endif
+
+#endif // __MOTION_STATE_H__
@@ -1,20 +1,19 @@
 #ifndef SIMPLESWITCH_H
 #define SIMPLESWITCH_H
 
-#include <functional>
 #include <memory>
+#include "Delegate.h"
 #include <ESP8266WiFi.h>
 extern "C" {
   #include <espnow.h>
   #include "user_interface.h"
 }
 #include "Ticker.h"
-#include <FunctionalInterrupt.h>
 
 class SimpleSwitch;
 
 /* 1 - button press (immediatelly), 2 - button still pressed after holdDetect time, 3 - button still pressed after holdDetect2 time */
-typedef std::function<void(SimpleSwitch *, int butonEvent)> SimpleSwitchCb;
+typedef Delegate<void(SimpleSwitch *, int butonEvent)> SimpleSwitchCb;
 
 class SimpleSwitch
 {
@@ -28,13 +27,17 @@ public:
 		m_holdDetect       = holdDetect;
 		m_holdDetect2      = holdDetect2;
 		pinMode(gpioPin,INPUT_PULLUP);
-		attachInterrupt(gpioPin, std::bind(&SimpleSwitch::onChange, this), CHANGE);
+		attachInterruptArg(gpioPin, onChangeISR, this, CHANGE);
 	}
 	~SimpleSwitch() {}
 protected:
 	void ICACHE_RAM_ATTR onChange(void);
 	void onHold(void);
 	void onHold2(void);
+	/* Plain function + this (no std::function / std::bind allocation) */
+	static void ICACHE_RAM_ATTR onChangeISR(void *s) {((SimpleSwitch *)s)->onChange();}
+	static void ICACHE_RAM_ATTR onHoldCB(SimpleSwitch *s) {s->onHold();}
+	static void ICACHE_RAM_ATTR onHold2CB(SimpleSwitch *s) {s->onHold2();}
 public:
 	SimpleSwitchCb  m_CB;
 	int      m_gpioPin;
@@ -8,46 +8,81 @@
  * published by the Free Software Foundation.
  */
 #include "Command.h"
+#include <functional>
 
 //====================================================================================
 //============================-- Command Queue --=====================================
 //====================================================================================
 
-CommandQueueItem::CommandQueueItem(Command *c, char *cmdline, CommandQueueCB cb)
+const char * const commandParseErrors[] = {"", "Bad argument", "Argument out of range", "Too many arguments"};
+
+/*!
+ * \brief Parse one number ("-12", "2.5", "+0.125"), stops at ',' or end of string.
+ * Up to three fraction digits are kept, further digits are ignored.
+ */
+int commandParseNumber(const char *&p, int32_t *ip, int16_t *frac)
 {
-	char *arg;
-	cmddebug("CommandQueueItem::constructor\n");
-	m_parent     = c;
-	m_cb         = cb;
-	m_arg_mask   = 0;
-	/* Parse Arguments */
-	arg = strtok_r(NULL, ",", &cmdline);
-	if (arg) {
-		if (arg[0] == 'B') m_arg0=0xff; else m_arg0 = atoi(arg);
-		m_arg_mask |= 1;
-		arg = strtok_r(NULL, ",", &cmdline);
-		if (arg) {
-			m_arg1 = atoi(arg);
-			m_arg_mask |= 2;
-			arg = strtok_r(NULL, ",", &cmdline);
-			if (arg) {
-				m_arg2 = atoi(arg);
-				m_arg_mask |= 4;
-			}
+	uint32_t v = 0, f = 0, fd = 0, d, limit;
+	bool neg = false, digits = false;
+
+	while (*p == ' ') p++;
+	if ((*p == '-') || (*p == '+')) neg = (*p++ == '-');
+	limit = neg ? 2147483648u : 2147483647u;
+	while ((*p >= '0') && (*p <= '9')) {
+		d = *p++ - '0';
+		/* Checked before the multiply, v * 10 must not wrap */
+		if (v > (limit - d) / 10) return CMD_PARSE_RANGE;
+		v = v * 10 + d;
+		digits = true;
+	}
+	if (*p == '.') {
+		p++;
+		while ((*p >= '0') && (*p <= '9')) {
+			if (fd < 3) {f = f * 10 + (*p - '0'); fd++;}
+			p++;
+			digits = true;
 		}
+		while (fd++ < 3) f *= 10;
 	}
+	while (*p == ' ') p++;
+	if (!digits || ((*p != ',') && (*p != '\0'))) return CMD_PARSE_SYNTAX;
+	*ip   = neg ? (int32_t)(0u - v) : (int32_t)v;
+	*frac = neg ? -(int16_t)f : (int16_t)f;
+	return CMD_PARSE_OK;
 }
 //====================================================================================
 
-CommandQueueItem::~CommandQueueItem()
+int CommandQueueItem::set(Command *c, const char *args, const CommandQueueCB &cb)
 {
-	cmddebug("CommandQueueItem::destructor\n");
+	int rc;
+
+	cmddebug("CommandQueueItem::set\n");
+	m_parent     = c;
+	m_cb         = cb;
+	m_argc       = 0;
+	m_arg_mask   = 0;
+	if (!args || (*args == '\0')) return CMD_PARSE_OK;
+	/* Parse Arguments */
+	for (;;) {
+		if (m_argc == COMMAND_MAX_ARGS) return CMD_PARSE_TOO_MANY;
+		rc = commandParseNumber(args, &m_arg[m_argc], &m_frac[m_argc]);
+		if (rc != CMD_PARSE_OK) return rc;
+		m_arg_mask |= (1 << m_argc);
+		m_argc++;
+		if (*args == '\0') break;
+		args++;                          // Skip ','
+	}
+	return CMD_PARSE_OK;
 }
 //====================================================================================
 
-void CommandQueueItem::print(String s)
+void CommandQueueItem::print(const char *s, int len)
 {
-	m_parent->print(s);
+	if (m_seq >= 0) {
+		ResponseWriter(this).add(s, len);
+	} else {
+		m_parent->print(s, len);
+	}
 }
 //====================================================================================
 
@@ -55,6 +90,13 @@ void CommandQueueItem::print(String s)
 //==============================-- Command DB --======================================
 //====================================================================================
 
+CommandDB::CommandDB(): m_textCount(0), m_defaultHandler(NULL), m_detachHandler(NULL), m_poolTaken(0), m_poolExhausted(0), m_poolPeak(0), m_mapLookups(0),
+	m_rtCount(0), m_rtLast(0), m_rtMax(0), m_rtOver(0), m_motionOwner(NULL)
+{
+	for (int i = 0; i < COMMAND_POOL_SIZE; ++i) m_free.push(&m_pool[i]);
+}
+//====================================================================================
+
 void CommandDB::addCommand(const char *command, CommandQueueCB cb, bool waitMotors)
 {
 	cmddebug2("Add command <%s>\n",command);
@@ -64,25 +106,445 @@ void CommandDB::addCommand(const char *command, CommandQueueCB cb, bool waitMoto
 
 void CommandDB::executeCommand(Command *c, char *line)
 {
-	char *last = NULL, *command;
+	char *command = line, *args = NULL;
+	int rc;
 	
 	cmddebug2("Execute command <%s>\n",line);
-	command = strtok_r(line, ",", &last);   // Search for command at start of buffer
-	if (command != NULL) {
+	/* Optional sequence number "N<seq> ", echoed in the replies */
+	int32_t seq = -1;
+	if ((line[0] == 'N') && (line[1] >= '0') && (line[1] <= '9')) {
+		seq = 0;
+		line++;
+		while ((*line >= '0') && (*line <= '9')) seq = (seq * 10 + (*line++ - '0')) & 0x7fffffff;
+		while (*line == ' ') line++;
+		command = line;
+	}
+	/* Command name ends at the first ',' (terminated in place, arguments are parsed from the buffer) */
+	while (*line && (*line != ',')) line++;
+	if (*line == ',') {
+		*line = '\0';
+		args  = line + 1;
+	}
+	if (*command == '\0') return;
+	/* Macro definition: lines are compiled, not executed */
+	if ((m_macros.m_rec == c) || (strcmp(command, "DEF") == 0)) {
+		defineMacro(c, seq, command, args);
+		return;
+	}
+	for (int t = 0; t < m_textCount; ++t) {
+		if (strcmp(command, m_text[t].name) == 0) {
+			m_text[t].cb(c, seq, args);
+			return;
+		}
+	}
+	/* Built-in commands first (no allocation for the lookup) */
+	const CommandTableEntry *e = m_table.find(command);
+	const CommandDBItem *item  = NULL;
+	if (!e) {
+		m_mapLookups++;
 		auto it = m_commandMap.find(String(command));
-		if (it != m_commandMap.end()) {
-			/* Push command to command queue */
-			CommandQueueItemPtr cqi = std::make_shared<CommandQueueItem>(c, last, it->second->m_cb);
-			if (it->second->m_waitMotors) {
-				m_motionQueue.emplace_back(cqi);
-			} else {
-				m_commandQueue.emplace_back(cqi);
+		if (it == m_commandMap.end()) {
+			const CommandMacro *m = m_macros.find(command);
+			if (m) {
+				executeMacro(c, seq, m, args);
+				return;
 			}
-		} else if (m_defaultHandler != NULL) {
 			cmddebug2("Command not found <%s>!\n",command);
-			(*m_defaultHandler)(command, c);
+			if (seq >= 0) {
+				replyError(c, seq, "Unknown command");
+			} else if (m_defaultHandler != NULL) {
+				(*m_defaultHandler)(command, c);
+			}
+			return;
+		}
+		item = it->second.get();
+	}
+	/* Push command to command (or motion) queue */
+	CommandQueueItem *cqi = take();
+	if (!cqi) {
+		replyError(c, seq, "Command queue full");
+		return;
+	}
+	bool waitMotors;
+	if (e) {
+		rc = cqi->set(c, args, e->fn);
+		waitMotors = e->waitMotors;
+	} else {
+		rc = cqi->set(c, args, item->m_cb);
+		waitMotors = item->m_waitMotors;
+	}
+	cqi->m_seq = seq;
+	if (rc != CMD_PARSE_OK) {
+		releaseItem(cqi);
+		replyError(c, seq, commandParseErrors[rc]);
+		return;
+	}
+	cqi->m_tRecv   = c->m_tRecv;
+	cqi->m_tQueued = LAT_STAMP();
+	LAT_RECORD(LAT_PARSE, cqi->m_tQueued - c->m_tRecv);
+	if (waitMotors) {
+		m_motionQueue.push(cqi);
+	} else {
+		m_commandQueue.push(cqi);
+	}
+}
+//====================================================================================
+
+const char *CommandDB::check(char *line)
+{
+	char *command, *args = NULL;
+	CommandQueueItem tmp;
+	int rc;
+
+	if ((line[0] == 'N') && (line[1] >= '0') && (line[1] <= '9')) {
+		line++;
+		while ((*line >= '0') && (*line <= '9')) line++;
+		while (*line == ' ') line++;
+	}
+	command = line;
+	while (*line && (*line != ',')) line++;
+	if (*line == ',') {
+		*line = '\0';
+		args  = line + 1;
+	}
+	if (*command == '\0') return NULL;
+	for (int t = 0; t < m_textCount; ++t) {
+		if (strcmp(command, m_text[t].name) == 0) return NULL;
+	}
+	if (!m_table.find(command) && (m_commandMap.find(String(command)) == m_commandMap.end()) && !m_macros.find(command)) {
+		return "Unknown command";
+	}
+	rc = tmp.set(NULL, args, nullptr);
+	return (rc == CMD_PARSE_OK) ? NULL : commandParseErrors[rc];
+}
+//====================================================================================
+
+void CommandDB::defineMacro(Command *c, int32_t seq, const char *command, const char *args)
+{
+	const char *err;
+
+	if (m_macros.m_rec != c) {
+		/* DEF,name */
+		err = (args && m_table.find(args)) ? "Name of a built-in command" : m_macros.begin(c, args);
+	} else if (strcmp(command, "END") == 0) {
+		err = m_macros.end();
+	} else {
+		err = m_macros.add(m_table, command, args);
+	}
+	if (err) {
+		replyError(c, seq, err);
+	} else {
+		ResponseWriter(c, seq).ok();
+	}
+}
+//====================================================================================
+
+/* Output of commands whose connection is gone (and of macro steps but the last) */
+static Command nullCommand(NULL);
+
+void CommandDB::executeMacro(Command *c, int32_t seq, const CommandMacro *m, const char *args)
+{
+	CommandQueueItem params, *i, *last = NULL;
+	const uint8_t *code = m_macros.m_code + m->off;
+	bool motion = false;
+	uint8_t entry;
+	int rc, n;
+
+	rc = params.set(c, args, nullptr);
+	if (rc != CMD_PARSE_OK) {
+		replyError(c, seq, commandParseErrors[rc]);
+		return;
+	}
+	if (params.m_argc < m->params) {
+		replyError(c, seq, "Missing macro argument");
+		return;
+	}
+	/* All steps or nothing */
+	if (m_free.size() < m->steps) {
+		m_poolExhausted++;
+		replyError(c, seq, "Command queue full");
+		return;
+	}
+	uint32_t t = LAT_STAMP();
+	LAT_RECORD(LAT_PARSE, t - c->m_tRecv);
+	for (n = 0; n < m->steps; ++n) {
+		i    = take();
+		code = CommandMacros::decode(code, &params, i, &entry);
+		const CommandTableEntry *e = &m_table.m_entries[entry];
+		i->m_parent  = &nullCommand;
+		i->m_cb      = e->fn;
+		i->m_seq     = -1;
+		i->m_tRecv   = c->m_tRecv;
+		i->m_tQueued = t;
+		if (e->waitMotors) {
+			m_motionQueue.push(i);
+			last   = i;
+			motion = true;
+		} else {
+			m_commandQueue.push(i);
+			if (!motion) last = i;
 		}
 	}
+	/* One reply per call: the step that runs last replies with the seq of the call */
+	last->m_parent = c;
+	last->m_seq    = seq;
+}
+//====================================================================================
+
+void CommandDB::printMacros(CommandQueueItem *c)
+{
+	ResponseWriter w(c);
+	int i;
+
+	for (i = 0; i < m_macros.m_count; ++i) {
+		const CommandMacro *m = &m_macros.m_macros[i];
+		w.printf("MAC,%s,steps=%u,params=%u,bytes=%u\r\n", m->name, m->steps, m->params, m->len);
+	}
+	w.printf("MAC,free=%u/%u\r\nOK\r\n", (uint32_t)(MACRO_BYTES - m_macros.m_used), (uint32_t)MACRO_BYTES);
 }
 //====================================================================================
 
+void CommandDB::detach(Command *c)
+{
+	CommandQueueItem *i;
+
+	for (i = m_commandQueue.m_head; i; i = i->m_next) if (i->m_parent == c) i->m_parent = &nullCommand;
+	for (i = m_motionQueue.m_head; i; i = i->m_next) if (i->m_parent == c) i->m_parent = &nullCommand;
+	if (m_macros.m_rec == c) m_macros.cancel();
+	if (m_motionOwner == c) m_motionOwner = NULL;
+	if (m_detachHandler != NULL) (*m_detachHandler)(c);
+}
+//====================================================================================
+
+int CommandDB::pending(const Command *c) const
+{
+	const CommandQueueItem *i;
+	int n = 0;
+
+	for (i = m_commandQueue.m_head; i; i = i->m_next) if (i->m_parent == c) n++;
+	for (i = m_motionQueue.m_head; i; i = i->m_next) if (i->m_parent == c) n++;
+	return n;
+}
+//====================================================================================
+
+void CommandDB::executeRealtime(Command *c, uint8_t rt, uint32_t t0)
+{
+	uint32_t t;
+
+	m_realtime(c, rt);
+	t = ESP.getCycleCount() - t0;
+	m_rtCount++;
+	m_rtLast = t;
+	if (t > m_rtMax) m_rtMax = t;
+	if (t > (RT_LATENCY_LIMIT * ESP.getCpuFreqMHz())) m_rtOver++;
+}
+//====================================================================================
+
+void CommandDB::cancelMotion(const char *reason)
+{
+	CommandQueueItem *i;
+
+	while ((i = m_motionQueue.pop()) != NULL) {
+		replyError(i->m_parent, i->m_seq, reason);
+		i->m_seq = -1;
+		releaseItem(i);
+	}
+}
+//====================================================================================
+
+void CommandDB::printRealtime(CommandQueueItem *c)
+{
+	const uint32_t cpu = ESP.getCpuFreqMHz();
+
+	ResponseWriter(c).printf("RT,count=%u,last=%uus,max=%uus,limit=%uus,over=%u\r\nOK\r\n", m_rtCount, m_rtLast / cpu, m_rtMax / cpu,
+		(uint32_t)RT_LATENCY_LIMIT, m_rtOver);
+}
+//====================================================================================
+
+void CommandDB::run(CommandQueueItem *i)
+{
+#ifdef LATENCY_TRACE
+	uint32_t t = LAT_STAMP();
+
+	LAT_RECORD(LAT_QUEUE, t - i->m_tQueued);
+	if (i->m_parent) {
+		/* Per connection (transport comparison) */
+		uint32_t l = t - i->m_tRecv;
+		i->m_parent->m_cmdCount++;
+		i->m_parent->m_cmdLatSum += l;
+		if (l > i->m_parent->m_cmdLatMax) i->m_parent->m_cmdLatMax = l;
+	}
+	/* Motion1D stamps the moves queued by this command */
+	latencyTrace.m_recv = i->m_tRecv;
+	latencyTrace.m_exec = t;
+	i->execute();
+	LAT_RECORD(LAT_EXEC, LAT_STAMP() - t);
+	latencyTrace.m_recv = 0;
+	latencyTrace.m_exec = 0;
+#else
+	i->execute();
+#endif
+	release(i);
+}
+//====================================================================================
+
+void CommandDB::release(CommandQueueItem *i)
+{
+	if ((i->m_seq >= 0) && i->m_parent) i->m_parent->m_lastSeq = i->m_seq;
+	i->m_seq = -1;
+	releaseItem(i);
+}
+//====================================================================================
+
+void CommandDB::replyError(Command *c, int32_t seq, const char *text)
+{
+	ResponseWriter(c, seq).error(text);
+}
+//====================================================================================
+
+void CommandDB::executeBinary(Command *c, uint8_t op, uint8_t *payload, int len)
+{
+	uint8_t out[BIN_REPLY_MAX + 1];
+	int outLen = 0;
+
+	out[0] = BIN_OK;
+	switch (op) {
+		case BIN_OP_PING:
+			out[1] = BIN_VERSION;
+			outLen = 1;
+			break;
+		case BIN_OP_TEXT:
+			/* Text command, the replies come back as BIN_OP_TEXT frames */
+			payload[len] = '\0';
+			executeCommand(c, (char *)payload);
+			return;
+		case BIN_OP_TEXT_MODE:
+			c->sendFrame(op | BIN_REPLY, out, 1);
+			c->setBinaryMode(false);
+			return;
+		default:
+			if ((op < BIN_OP_MAX) && m_binary[op]) {
+				out[0] = m_binary[op](c, payload, len, out + 1, &outLen);
+			} else {
+				out[0] = BIN_UNKNOWN;
+			}
+			break;
+	}
+	c->sendFrame(op | BIN_REPLY, out, outLen + 1);
+}
+//====================================================================================
+
+void CommandDB::benchLookup(CommandQueueItem *c)
+{
+	std::map<String, CommandDBItemPtr> ref;
+	const uint32_t loops = 4096;
+	uint32_t i, n = m_table.m_count, hits = 0, t0, tMap, tTable;
+
+	if (n == 0) {
+		c->sendErrorText("No built-in commands");
+		return;
+	}
+	/* The same names in a std::map<String> (lookup used before the built-in table) */
+	for (i = 0; i < n; ++i) ref[String(m_table.m_entries[i].name)] = std::make_shared<CommandDBItem>(m_table.m_entries[i].fn, m_table.m_entries[i].waitMotors);
+	t0 = micros();
+	for (i = 0; i < loops; ++i) {
+		if (ref.find(String(m_table.m_entries[i % n].name)) != ref.end()) hits++;
+	}
+	tMap = micros() - t0;
+	yield();
+	t0 = micros();
+	for (i = 0; i < loops; ++i) {
+		if (m_table.find(m_table.m_entries[i % n].name)) hits++;
+	}
+	tTable = micros() - t0;
+	ResponseWriter(c).printf("LB,map=%u/s,table=%u/s,commands=%u+%u%s\r\nOK\r\n", (uint32_t)(((uint64_t)loops * 1000000) / (tMap ? tMap : 1)),
+		(uint32_t)(((uint64_t)loops * 1000000) / (tTable ? tTable : 1)), n, (uint32_t)m_commandMap.size(), (hits == 2 * loops) ? "" : ",lookup mismatch");
+}
+//====================================================================================
+
+void CommandDB::printStat(CommandQueueItem *c)
+{
+	ResponseWriter(c).printf("QS,pool=%d/%d,peak=%d,taken=%u,exhausted=%u,queue=%d/%d,map_lookups=%u,heap=%u\r\nOK\r\n", m_free.size(), COMMAND_POOL_SIZE,
+		m_poolPeak, m_poolTaken, m_poolExhausted, m_commandQueue.size(), m_motionQueue.size(), m_mapLookups, ESP.getFreeHeap());
+}
+//====================================================================================
+
+static volatile uint32_t dispatchCount;
+static void __attribute__((noinline)) dispatchTarget(CommandQueueItem *c) {dispatchCount++;}
+
+void CommandDB::benchDispatch(CommandQueueItem *c)
+{
+	std::function<void(CommandQueueItem *c)> sf = dispatchTarget;
+	CommandQueueCB dg = dispatchTarget;
+	const uint32_t loops = 1000;
+	uint32_t i, t0, tFn, tDg;
+
+	t0 = ESP.getCycleCount();
+	for (i = 0; i < loops; ++i) sf(c);
+	tFn = ESP.getCycleCount() - t0;
+	t0 = ESP.getCycleCount();
+	for (i = 0; i < loops; ++i) dg(c);
+	tDg = ESP.getCycleCount() - t0;
+	ResponseWriter(c).printf("DC,function=%ucyc/%uB,delegate=%ucyc/%uB,item=%uB,pool=%uB,heap=%u\r\nOK\r\n", tFn / loops, (uint32_t)sizeof(sf), tDg / loops,
+		(uint32_t)sizeof(dg), (uint32_t)sizeof(CommandQueueItem), (uint32_t)sizeof(m_pool), ESP.getFreeHeap());
+}
+//====================================================================================
+
+//====================================================================================
+//===============================-- Command --========================================
+//====================================================================================
+
+void Command::handleData(const char *data, int n)
+{
+	uint32_t t0 = ESP.getCycleCount();    // Reception time (real-time commands, latency trace)
+	int i;
+
+	m_tRecv = t0;	
+	for (i=0; i < n; ++i) {
+		char inChar = data[i];
+		if (m_binary) {
+			int rc = m_framer.feed(inChar);
+			if (rc > 0) {
+				m_db->executeBinary(this, m_framer.m_op, m_framer.m_buf, m_framer.m_len);
+			} else if (rc < 0) {
+				uint8_t st = BIN_BAD_CRC;
+				sendFrame(BIN_REPLY, &st, 1);
+			}
+			continue;
+		}
+		if (m_realtimeBytes && ((inChar == RT_STOP) || (inChar == RT_HOLD) || (inChar == RT_RESUME) || (inChar == RT_STATUS))) {
+			if (m_db->m_realtime) {
+				m_db->executeRealtime(this, inChar, t0);
+				continue;
+			}
+		}
+		if ((inChar == '\r') || (inChar == '\n')) {
+			if (m_overflow) {
+				m_overflow = false;
+				m_overflows++;
+				clearBuffer();
+				print("!8 Err: Line too long\r\n");
+			} else if (bufPos) {
+				buffer[bufPos] = '\0';
+				m_db->executeCommand(this, buffer);
+				clearBuffer();
+			}
+		} else if (isprint(inChar)) {     // Only printable characters into the buffer
+			if (bufPos < COMMAND_BUFFER) {
+				buffer[bufPos++] = inChar;  // Put character into buffer
+			} else {
+				m_overflow = true;          // Drop the rest of the line
+			}
+		}
+	}
+}
+//====================================================================================
+
+void Command::printLatency(ResponseWriter &w)
+{
+	const uint32_t mhz = ESP.getCpuFreqMHz();
+	uint32_t avg = m_cmdCount ? (uint32_t)(m_cmdLatSum / m_cmdCount) : 0;
+
+	w.printf("cmds=%u,avg=%uus,max=%uus", m_cmdCount, avg / mhz, m_cmdLatMax / mhz);
+}
+//====================================================================================
@@ -0,0 +1,171 @@
+/*
+ * Command macros (named command sequences stored pre-parsed).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "Command.h"
+
+const char *CommandMacros::begin(Command *c, const char *name)
+{
+	int n;
+
+	if (m_rec) return "Macro definition in progress";
+	if (!name) return "Missing macro name";
+	while (*name == ' ') name++;
+	for (n = 0; name[n]; ++n) {
+		if ((n == MACRO_NAME) || !isalnum(name[n])) return "Bad macro name";
+	}
+	if (n == 0) return "Missing macro name";
+	memcpy(m_def.name, name, n + 1);
+	m_def.off    = m_used;
+	m_def.len    = 0;
+	m_def.steps  = 0;
+	m_def.params = 0;
+	m_rec        = c;
+	return NULL;
+}
+//====================================================================================
+
+bool CommandMacros::put(const void *d, int len)
+{
+	if ((m_def.off + m_def.len + len) > MACRO_BYTES) return false;
+	memcpy(m_code + m_def.off + m_def.len, d, len);
+	m_def.len += len;
+	return true;
+}
+//====================================================================================
+
+const char *CommandMacros::add(const CommandTableView &table, const char *command, const char *args)
+{
+	const CommandTableEntry *e = table.find(command);
+	uint16_t start = m_def.len;
+	uint8_t hdr[2], b[7];
+	int32_t v;
+	int16_t f;
+	int rc;
+
+	if (!e) return "Not a built-in command";
+	if (m_def.steps == MACRO_MAX_STEPS) return "Too many macro steps";
+	hdr[0] = e - table.m_entries;
+	hdr[1] = 0;
+	if (!put(hdr, 2)) goto full;
+	while (args && *args) {
+		if (hdr[1] == COMMAND_MAX_ARGS) {m_def.len = start; return commandParseErrors[CMD_PARSE_TOO_MANY];}
+		while (*args == ' ') args++;
+		if (*args == '$') {
+			/* Parameter $1..$9 */
+			args++;
+			if ((*args < '1') || (*args > '9')) {m_def.len = start; return commandParseErrors[CMD_PARSE_SYNTAX];}
+			b[0] = MACRO_ARG_PARAM;
+			b[1] = *args++ - '1';
+			while (*args == ' ') args++;
+			if ((*args != ',') && (*args != '\0')) {m_def.len = start; return commandParseErrors[CMD_PARSE_SYNTAX];}
+			if ((b[1] + 1) > m_def.params) m_def.params = b[1] + 1;
+			if (!put(b, 2)) goto full;
+		} else {
+			rc = commandParseNumber(args, &v, &f);
+			if (rc != CMD_PARSE_OK) {m_def.len = start; return commandParseErrors[rc];}
+			if (f) {
+				b[0] = MACRO_ARG_FIX;
+				bin_put_u32(b + 1, v);
+				bin_put_u16(b + 5, f);
+				rc = put(b, 7);
+			} else if ((v >= -128) && (v <= 127)) {
+				b[0] = MACRO_ARG_I8;
+				b[1] = (uint8_t)v;
+				rc = put(b, 2);
+			} else {
+				b[0] = MACRO_ARG_I32;
+				bin_put_u32(b + 1, v);
+				rc = put(b, 5);
+			}
+			if (!rc) goto full;
+		}
+		hdr[1]++;
+		if (*args == ',') args++;
+	}
+	m_code[m_def.off + start + 1] = hdr[1];
+	m_def.steps++;
+	return NULL;
+full:
+	m_def.len = start;
+	return "Macro memory full";
+}
+//====================================================================================
+
+void CommandMacros::remove(int n)
+{
+	CommandMacro *m = &m_macros[n];
+	uint16_t off = m->off, len = m->len;
+	int i;
+
+	/* Compact the bytecode (the definition in progress lies after m_used) */
+	memmove(m_code + off, m_code + off + len, (m_def.off + m_def.len) - (off + len));
+	for (i = 0; i < m_count; ++i) if (m_macros[i].off > off) m_macros[i].off -= len;
+	m_used  -= len;
+	m_def.off -= len;
+	m_macros[n] = m_macros[--m_count];
+}
+//====================================================================================
+
+const char *CommandMacros::end()
+{
+	int i;
+
+	m_rec = NULL;
+	for (i = 0; i < m_count; ++i) {
+		if (strcmp(m_macros[i].name, m_def.name) == 0) {
+			remove(i);
+			break;
+		}
+	}
+	if (m_def.steps == 0) return NULL;     // Deleted
+	if (m_count == MACRO_MAX) return "Too many macros";
+	m_macros[m_count++] = m_def;
+	m_used += m_def.len;
+	return NULL;
+}
+//====================================================================================
+
+const CommandMacro *CommandMacros::find(const char *name) const
+{
+	int i;
+
+	for (i = 0; i < m_count; ++i) if (strcmp(m_macros[i].name, name) == 0) return &m_macros[i];
+	return NULL;
+}
+//====================================================================================
+
+const uint8_t *CommandMacros::decode(const uint8_t *p, const CommandQueueItem *params, CommandQueueItem *i, uint8_t *entry)
+{
+	int n, argc;
+
+	*entry      = p[0];
+	argc        = p[1];
+	p += 2;
+	i->m_argc     = argc;
+	i->m_arg_mask = (1u << argc) - 1;
+	for (n = 0; n < argc; ++n) {
+		i->m_frac[n] = 0;
+		switch (p[0]) {
+			case MACRO_ARG_I8:    i->m_arg[n] = (int8_t)p[1]; p += 2; break;
+			case MACRO_ARG_I32:   i->m_arg[n] = (int32_t)bin_get_u32(p + 1); p += 5; break;
+			case MACRO_ARG_FIX:
+				i->m_arg[n]  = (int32_t)bin_get_u32(p + 1);
+				i->m_frac[n] = (int16_t)bin_get_u16(p + 5);
+				p += 7;
+				break;
+			default:
+				i->m_arg[n]  = params->m_arg[p[1]];
+				i->m_frac[n] = params->m_frac[p[1]];
+				p += 2;
+				break;
+		}
+	}
+	return p;
+}
+//====================================================================================
@@ -0,0 +1,187 @@
+/*
+ * EspNowCommand - Execute binary opcodes sent over ESP-NOW (pendant, foot pedal).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "EspNowCommand.h"
+#include "ResponseWriter.h"
+
+//====================================================================================
+//=============================-- ESP-NOW peer --=====================================
+//====================================================================================
+
+void EspNowPeer::attach(CommandDB *db, EspNowLink *link, const uint8_t *mac)
+{
+	m_db       = db;
+	m_link     = link;
+	memcpy(m_mac, mac, ESPNOW_MAC_LEN);
+	m_rxSeq    = 0;
+	m_replyLen = 0;
+	m_rx       = m_dups = 0;
+	m_lastSeq  = -1;
+	m_creditInterval = 0;
+	m_creditSent     = -1;
+	resetLatency();
+	m_binary   = true;                     // Messages only, no text lines
+}
+//====================================================================================
+
+void EspNowPeer::detach()
+{
+	if (!m_link) return;
+	m_db->detach(this);
+	m_link = NULL;
+}
+//====================================================================================
+
+void EspNowPeer::receive(const uint8_t *data, int len)
+{
+	uint8_t seq = data[0], op = data[1];
+
+	m_rx++;
+	if (seq && (seq == m_rxSeq)) {
+		/* Resent request (our reply was lost), do not execute it twice */
+		m_dups++;
+		if (m_replyLen) m_link->send(m_mac, m_reply, m_replyLen);
+		return;
+	}
+	m_rxSeq    = seq;
+	m_replyLen = 0;
+	m_binary   = true;
+	m_tRecv    = ESP.getCycleCount();
+	/* Payload into the line buffer (room for the zero of BIN_OP_TEXT) */
+	len -= ESPNOW_HEADER;
+	memcpy(buffer, data + ESPNOW_HEADER, len);
+	m_inRx = true;
+	m_db->executeBinary(this, op, (uint8_t *)buffer, len);
+	m_inRx = false;
+}
+//====================================================================================
+
+void EspNowPeer::sendFrame(uint8_t op, const uint8_t *payload, int len)
+{
+	uint8_t m[ESPNOW_MAX_DATA];
+	int n;
+
+	if (!m_link) return;
+	m[0] = m_inRx ? m_rxSeq : 0;           // Later replies (queued commands) carry no seq
+	m[1] = op;
+	do {
+		n = len;
+		if (n > (ESPNOW_MAX_DATA - ESPNOW_HEADER)) n = ESPNOW_MAX_DATA - ESPNOW_HEADER;
+		memcpy(m + ESPNOW_HEADER, payload, n);
+		m_link->send(m_mac, m, n + ESPNOW_HEADER);
+		if (m_inRx && !m_replyLen && ((n + ESPNOW_HEADER) <= (int)sizeof(m_reply))) {
+			memcpy(m_reply, m, n + ESPNOW_HEADER);
+			m_replyLen = n + ESPNOW_HEADER;
+		}
+		payload += n;
+		len     -= n;
+	} while (len > 0);
+}
+//====================================================================================
+
+//====================================================================================
+//===========================-- ESP-NOW endpoint --===================================
+//====================================================================================
+
+EspNowCommand::EspNowCommand(CommandDB *db, EspNowLink *link): m_db(db), m_link(link), m_ok(false), m_pairStart(0), m_pairTime(0),
+	m_rejected(0), m_errors(0)
+{
+}
+//====================================================================================
+
+bool EspNowCommand::begin()
+{
+	m_link->onReceive([this](const uint8_t *mac, const uint8_t *data, int len) {
+		onReceive(mac, data, len);
+	});
+	m_ok = m_link->begin();
+	return m_ok;
+}
+//====================================================================================
+
+void EspNowCommand::onReceive(const uint8_t *mac, const uint8_t *data, int len)
+{
+	EspNowPeer *p = NULL;
+	int i;
+
+	if (len < ESPNOW_HEADER) {
+		m_errors++;
+		return;
+	}
+	for (i = 0; i < ESPNOW_MAX_PEERS; ++i) {
+		if (m_peers[i].is(mac)) {
+			p = &m_peers[i];
+			break;
+		}
+	}
+	if (!p) {
+		/* Pair a new sender (only while the pairing window is open) */
+		if (!pairing()) {
+			m_rejected++;
+			return;
+		}
+		for (i = 0; i < ESPNOW_MAX_PEERS; ++i) {
+			if (!m_peers[i].active()) {
+				p = &m_peers[i];
+				break;
+			}
+		}
+		if (!p || !m_link->addPeer(mac)) {
+			m_rejected++;
+			return;
+		}
+		p->attach(m_db, m_link, mac);
+	}
+	p->receive(data, len);
+}
+//====================================================================================
+
+bool EspNowCommand::pair(uint32_t seconds)
+{
+	if ((seconds == 0) || (seconds > ESPNOW_PAIR_MAX)) return false;
+	m_pairStart = millis();
+	m_pairTime  = seconds * 1000;
+	return true;
+}
+//====================================================================================
+
+bool EspNowCommand::pairing()
+{
+	if (m_pairTime && ((millis() - m_pairStart) >= m_pairTime)) m_pairTime = 0;
+	return m_pairTime != 0;
+}
+//====================================================================================
+
+void EspNowCommand::unpair()
+{
+	int i;
+
+	m_pairTime = 0;
+	for (i = 0; i < ESPNOW_MAX_PEERS; ++i) m_peers[i].detach();
+}
+//====================================================================================
+
+void EspNowCommand::printStat(CommandQueueItem *c)
+{
+	ResponseWriter w(c);
+	int i, n = 0;
+
+	for (i = 0; i < ESPNOW_MAX_PEERS; ++i) if (m_peers[i].active()) n++;
+	w.printf("EN,ok=%d,peers=%d/%d,pairing=%us,rejected=%u,errors=%u\r\n", m_ok ? 1 : 0, n, ESPNOW_MAX_PEERS,
+		pairing() ? (uint32_t)(m_pairTime - (millis() - m_pairStart) + 999) / 1000 : 0, m_rejected, m_errors);
+	for (i = 0; i < ESPNOW_MAX_PEERS; ++i) {
+		EspNowPeer &p = m_peers[i];
+		if (!p.active()) continue;
+		w.printf("EP%d,%02x:%02x:%02x:%02x:%02x:%02x,rx=%u,dups=%u,", i, p.m_mac[0], p.m_mac[1], p.m_mac[2], p.m_mac[3], p.m_mac[4], p.m_mac[5], p.m_rx, p.m_dups);
+		p.printLatency(w);
+		w.add("\r\n");
+	}
+	w.ok();
+}
+//====================================================================================
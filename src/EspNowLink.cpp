@@ -0,0 +1,45 @@
+/*
+ * ESP-NOW link (radio and loopback mock for host tests).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include <ESP8266WiFi.h>
+#include "EspNowLink.h"
+extern "C" {
+	#include <espnow.h>
+}
+
+static EspNowRadio *espNowRadio = NULL;
+
+bool EspNowRadio::begin()
+{
+	if (esp_now_init() != 0) return false;
+	espNowRadio = this;
+	esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+	esp_now_register_recv_cb([](uint8_t *mac, uint8_t *data, uint8_t len) {
+		if (espNowRadio && espNowRadio->m_recv) espNowRadio->m_recv(mac, data, len);
+	});
+	esp_now_register_send_cb([](uint8_t *mac, uint8_t status) {
+		if (status && espNowRadio) espNowRadio->m_sendFail++;
+	});
+	return true;
+}
+//====================================================================================
+
+bool EspNowRadio::addPeer(const uint8_t *mac)
+{
+	if (esp_now_is_peer_exist((uint8_t *)mac) > 0) return true;
+	return esp_now_add_peer((uint8_t *)mac, ESP_NOW_ROLE_COMBO, WiFi.channel(), NULL, 0) == 0;
+}
+//====================================================================================
+
+bool EspNowRadio::send(const uint8_t *mac, const uint8_t *data, int len)
+{
+	if (len > ESPNOW_MAX_DATA) return false;
+	return esp_now_send((uint8_t *)mac, (uint8_t *)data, len) == 0;
+}
+//====================================================================================
@@ -0,0 +1,209 @@
+/*
+ * FileCommand - execute command scripts stored on LittleFS.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "FileCommand.h"
+
+bool FileCommand::begin()
+{
+	m_mounted = LittleFS.begin();
+	return m_mounted;
+}
+//====================================================================================
+
+/*!
+ * \brief "/name" (plain names only, no directories).
+ */
+bool FileCommand::path(char *out, const char *name)
+{
+	int n;
+
+	if (!name) return false;
+	while (*name == ' ') name++;
+	for (n = 0; name[n]; ++n) {
+		if ((n == FILE_NAME) || (name[n] == '/') || !isprint(name[n])) return false;
+	}
+	if (n == 0) return false;
+	out[0] = '/';
+	memcpy(out + 1, name, n + 1);
+	return true;
+}
+//====================================================================================
+
+const char *FileCommand::start(Command *owner, const char *name)
+{
+	char p[FILE_NAME + 2];
+
+	if (!m_mounted) return "No filesystem";
+	if (running()) return "Job in progress";
+	if (!path(p, name)) return "Bad file name";
+	m_file = LittleFS.open(p, "r");
+	if (!m_file) return "File not found";
+	strcpy(m_name, p + 1);
+	m_owner    = owner;
+	m_chunkLen = m_chunkPos = 0;
+	m_eof      = false;
+	m_replyLen = 0;
+	m_replyLong = false;
+	m_size     = m_file.size();
+	m_bytes    = m_lines = m_ok = m_errors = 0;
+	m_start    = millis();
+	m_overflow = false;
+	clearBuffer();
+	return NULL;
+}
+//====================================================================================
+
+void FileCommand::finish(const char *state)
+{
+	m_file.close();
+	m_file = File();
+	m_eof  = false;
+	passReply();                         // Reply without a line end
+	m_replyLong = false;
+	if (m_owner) {
+		ResponseWriter(m_owner).printf("RUN,%s,%s,lines=%u,ok=%u,errors=%u,ms=%u\r\n", state, m_name, m_lines, m_ok, m_errors, (uint32_t)(millis() - m_start));
+	}
+}
+//====================================================================================
+
+void FileCommand::abort(const char *reason)
+{
+	if (running()) finish(reason);
+}
+//====================================================================================
+
+void FileCommand::feed(int credits)
+{
+	const char *p, *nl;
+	int len, lines = 0;
+
+	if (!running()) return;
+	if (m_eof) {
+		/* Done when the last queued command of the script has run */
+		if (m_db->pending(this) == 0) finish("done");
+		return;
+	}
+	while ((credits > 0) && (lines < FILE_LINES_PER_LOOP)) {
+		if (m_chunkPos == m_chunkLen) {
+			m_chunkLen = m_file.read((uint8_t *)m_chunk, FILE_CHUNK);
+			m_chunkPos = 0;
+			if (m_chunkLen <= 0) {
+				/* End of file, execute the last line even without a line end */
+				m_chunkLen = 0;
+				if (bufPos) m_lines++;
+				handleData("\n", 1);
+				if (running()) m_eof = true;
+				return;
+			}
+		}
+		/* Next line, or the rest of the chunk (the line buffer keeps the part) */
+		p   = m_chunk + m_chunkPos;
+		len = m_chunkLen - m_chunkPos;
+		nl  = (const char *)memchr(p, '\n', len);
+		if (nl) len = nl - p + 1;
+		m_chunkPos += len;
+		m_bytes    += len;
+		if (nl && (bufPos || (len > 1))) {
+			m_lines++;
+			credits--;
+			lines++;
+		}
+		handleData(p, len);
+		if (!running()) return;          // Stopped by an error reply
+	}
+}
+//====================================================================================
+
+/*!
+ * \brief Replies may come in parts or several lines at once, they are checked per line.
+ */
+void FileCommand::print(const char *s, int len)
+{
+	char ch;
+
+	while (len-- > 0) {
+		ch = *s++;
+		if (m_replyLen == FILE_REPLY) {
+			/* Too long for "OK" or an error, pass it on */
+			passReply();
+			m_replyLong = true;
+		}
+		m_reply[m_replyLen++] = ch;
+		if (ch == '\n') replyLine();
+	}
+}
+//====================================================================================
+
+void FileCommand::passReply()
+{
+	if (m_owner && m_replyLen) {
+		m_reply[m_replyLen] = '\0';
+		m_owner->print(m_reply, m_replyLen);
+	}
+	m_replyLen = 0;
+}
+//====================================================================================
+
+void FileCommand::replyLine()
+{
+	const char *p = m_reply, *end = m_reply + m_replyLen;
+	int n;
+
+	if (!m_replyLong) {
+		/* Skip "N<seq> " of a sequenced reply */
+		if ((*p == 'N') && (p + 1 < end) && isdigit(p[1])) {
+			for (n = 1; (p + n < end) && isdigit(p[n]); ++n);
+			if ((p + n < end) && (p[n] == ' ')) p += n + 1;
+		}
+		n = end - p;
+		while ((n > 0) && ((p[n - 1] == '\n') || (p[n - 1] == '\r'))) n--;
+		if ((n == 2) && (p[0] == 'O') && (p[1] == 'K')) {
+			m_ok++;
+			m_replyLen = 0;
+			return;
+		}
+	}
+	passReply();
+	if (!m_replyLong && (*p == '!')) {
+		m_errors++;
+		abort("error");
+	}
+	m_replyLong = false;
+}
+//====================================================================================
+
+void FileCommand::printStat(ResponseWriter &w)
+{
+	if (!running()) {
+		w.printf("RUN,idle,fs=%d\r\n", m_mounted ? 1 : 0);
+		return;
+	}
+	w.printf("RUN,run,%s,bytes=%u/%u,lines=%u,ok=%u,errors=%u,ms=%u\r\n", m_name, m_bytes, m_size, m_lines, m_ok, m_errors, (uint32_t)(millis() - m_start));
+}
+//====================================================================================
+
+void FileCommand::list(ResponseWriter &w)
+{
+	if (!m_mounted) return;
+	Dir dir = LittleFS.openDir("/");
+	while (dir.next()) {
+		w.printf("LS,%s,%u\r\n", dir.fileName().c_str(), (uint32_t)dir.fileSize());
+	}
+}
+//====================================================================================
+
+bool FileCommand::remove(const char *name)
+{
+	char p[FILE_NAME + 2];
+
+	if (!m_mounted || !path(p, name)) return false;
+	if (running() && (strcmp(m_name, p + 1) == 0)) return false;
+	return LittleFS.remove(p);
+}
+//====================================================================================
@@ -9,8 +9,10 @@
  */
 #include "HTTPCommand.h"
 #include "www_fs.h"
+#include "FileCommand.h"
 
 extern volatile int catCounter;
+extern FileCommand *FCmd;
 
 //====================================================================================
 //=============================-- NETWORK EVENTS--====================================
@@ -22,6 +24,24 @@ static void notFound(AsyncWebServerRequest *request)
 }
 //====================================================================================
 
+/*!
+ * \brief Script upload (multipart POST /upload, saved to LittleFS under its file name).
+ */
+static File uploadFile;
+
+static void handle_upload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final)
+{
+	if (index == 0) {
+		uploadFile.close();
+		if ((filename.length() > 0) && (filename.length() <= FILE_NAME) && (filename.indexOf('/') < 0)) {
+			uploadFile = LittleFS.open(("/" + filename).c_str(), "w");
+		}
+	}
+	if (uploadFile) uploadFile.write(data, len);
+	if (final) uploadFile.close();
+}
+//====================================================================================
+
 static void handle_request(AsyncWebServerRequest *request, char *type, const uint8_t * data, int len)
 {
 	AsyncWebServerResponse *response = request->beginResponse_P(200, type, data, len);
@@ -30,7 +50,128 @@ static void handle_request(AsyncWebServerRequest *request, char *type, const uin
 }
 //====================================================================================
 
-HTTPCommand::HTTPCommand(CommandDB *db): Command(db)
+/*!
+ * \brief Check one line of the batch (m_batchLine, zero terminated).
+ */
+void HTTPCommand::batchLine()
+{
+	char name[MACRO_NAME + 1], *p = m_batchLine;
+	const char *err = NULL;
+	int i, n;
+
+	m_batchLines++;
+	if (m_batchOverflow) {
+		err = "Line too long";
+	} else {
+		/* Command name (after an optional "N<seq> ") */
+		if ((p[0] == 'N') && (p[1] >= '0') && (p[1] <= '9')) {
+			p++;
+			while ((*p >= '0') && (*p <= '9')) p++;
+			while (*p == ' ') p++;
+		}
+		for (n = 0; p[n] && (p[n] != ','); ++n);
+		if (m_batchDef) {
+			/* Macro body, checked when the macro is defined */
+			if ((n == 3) && (memcmp(p, "END", 3) == 0)) m_batchDef = false;
+		} else if ((n == 3) && (memcmp(p, "DEF", 3) == 0)) {
+			m_batchDef = true;
+			if (p[3] == ',') p += 4;
+			for (n = 0; p[n] && (p[n] != ',') && (n < MACRO_NAME); ++n) name[n] = p[n];
+			name[n] = '\0';
+			if (m_batchMacroCount < BATCH_MACROS) strcpy(m_batchMacros[m_batchMacroCount++], name);
+		} else {
+			for (i = 0; i < m_batchMacroCount; ++i) {
+				if ((strlen(m_batchMacros[i]) == (size_t)n) && (memcmp(p, m_batchMacros[i], n) == 0)) break;
+			}
+			if (i == m_batchMacroCount) err = m_db->check(m_batchLine);
+		}
+	}
+	if (err && (m_batchErrors++ < BATCH_ERRORS)) {
+		m_batchResult += "L" + String(m_batchLines) + "," + String(err) + "\r\n";
+	}
+	m_batchLen      = 0;
+	m_batchOverflow = false;
+}
+//====================================================================================
+
+/*!
+ * \brief Body chunk of POST /batch: split into lines, check them, spool the chunk.
+ */
+void HTTPCommand::batchBody(AsyncWebServerRequest *request, const uint8_t *data, size_t len, size_t index)
+{
+	size_t i;
+	char c;
+
+	if (index == 0) {
+		if (m_batchReq) return;                 // Another batch in progress (answered in batchDone)
+		m_batchReq      = request;
+		m_batchLen      = 0;
+		m_batchOverflow = false;
+		m_batchDef      = false;
+		m_batchLines    = m_batchErrors = 0;
+		m_batchMacroCount = 0;
+		m_batchResult   = "";
+		if (!FCmd->running()) m_batchFile = LittleFS.open("/" BATCH_FILE, "w");
+		request->onDisconnect([this, request]() {
+			if (m_batchReq != request) return;
+			m_batchFile.close();
+			m_batchReq = NULL;
+		});
+	}
+	if (m_batchReq != request) return;
+	if (m_batchFile) m_batchFile.write(data, len);
+	for (i = 0; i < len; ++i) {
+		c = data[i];
+		if ((c == '\r') || (c == '\n')) {
+			if (m_batchLen || m_batchOverflow) {
+				m_batchLine[m_batchLen] = '\0';
+				batchLine();
+			}
+		} else if (m_batchLen < COMMAND_BUFFER) {
+			m_batchLine[m_batchLen++] = c;
+		} else {
+			m_batchOverflow = true;
+		}
+	}
+}
+//====================================================================================
+
+/*!
+ * \brief Body complete: results and start the job.
+ */
+void HTTPCommand::batchDone(AsyncWebServerRequest *request)
+{
+	const char *run = NULL;
+
+	if (m_batchReq != request) {
+		request->send(m_batchReq ? 409 : 400, "text/plain", m_batchReq ? "Batch in progress" : "Empty batch");
+		return;
+	}
+	if (m_batchLen || m_batchOverflow) {
+		m_batchLine[m_batchLen] = '\0';
+		batchLine();                          // Last line without a line end
+	}
+	if (m_batchFile) {
+		m_batchFile.close();
+		if (m_batchErrors) {
+			run = "errors";
+		} else if (m_batchDef) {
+			run = "DEF without END";
+		} else {
+			run = FCmd->start(this, BATCH_FILE);
+		}
+	} else {
+		run = FCmd->running() ? "Job in progress" : "No filesystem";
+	}
+	m_batchResult += "BATCH,lines=" + String(m_batchLines) + ",errors=" + String(m_batchErrors) + ",run=" + String(run ? run : "started") + "\r\n";
+	request->send(run ? 400 : 200, "text/plain", m_batchResult);
+	m_batchResult = "";
+	m_batchReq = NULL;
+}
+//====================================================================================
+
+HTTPCommand::HTTPCommand(CommandDB *db): Command(db), m_batchReq(NULL), m_batchLen(0), m_batchOverflow(false), m_batchDef(false),
+	m_batchLines(0), m_batchErrors(0), m_batchMacroCount(0)
 {
 	m_server = new AsyncWebServer(80);
 	m_events = new AsyncEventSource("/events");
@@ -55,6 +196,16 @@ HTTPCommand::HTTPCommand(CommandDB *db): Command(db)
 		request->send(200, "text/plain", message);
 	});
 
+	m_server->on("/batch", HTTP_POST, [this](AsyncWebServerRequest *request) {
+		batchDone(request);
+	}, NULL, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+		batchBody(request, data, len, index);
+	});
+
+	m_server->on("/upload", HTTP_POST, [](AsyncWebServerRequest *request) {
+		request->send(200, "text/plain", "OK");
+	}, handle_upload, NULL);
+
 	m_server->on("/cnt", HTTP_GET, [](AsyncWebServerRequest *request){
 		String message = "{\"cnt\": "+String(catCounter) + " }";
 		request->send(200, "application/json", message);
@@ -75,24 +226,3 @@ HTTPCommand::~HTTPCommand()
 	delete m_server;
 }
 //====================================================================================
-
-void HTTPCommand::handleData(const char *data, int n)
-{
-	int i;
-	
-	for (i=0; i < n; ++i) {
-		char inChar = data[i];
-		if ((inChar == '\r') || (inChar == '\n')) {
-			if (bufPos) {
-				buffer[bufPos] = '\0';
-				m_db->executeCommand(this, buffer);
-				clearBuffer();
-			}
-		} else if (isprint(inChar)) {     // Only printable characters into the buffer
-			if (bufPos < COMMAND_BUFFER) {
-				buffer[bufPos++] = inChar;  // Put character into buffer
-			}
-		}
-	}
-}
-//====================================================================================
@@ -0,0 +1,69 @@
+/*
+ * Command latency tracing (ccount stamps, log2 histograms per stage).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "LatencyTrace.h"
+#include "ResponseWriter.h"
+
+#ifdef LATENCY_TRACE
+LatencyTrace latencyTrace;
+#endif
+
+void LatencyTrace::reset()
+{
+	memset(m_hist, 0, sizeof(m_hist));
+	memset(m_count, 0, sizeof(m_count));
+	memset(m_max, 0, sizeof(m_max));
+	m_recv = 0;
+	m_exec = 0;
+}
+//====================================================================================
+
+/*!
+ * \brief Upper bound of bucket b [us].
+ */
+static uint32_t bucketUs(int b, uint32_t mhz)
+{
+	if (b >= 31) return 0xffffffffu / mhz;
+	return ((2u << b) + mhz - 1) / mhz;
+}
+//====================================================================================
+
+void LatencyTrace::print(ResponseWriter &w)
+{
+	static const char * const names[LAT_STAGES] = {"parse", "queue", "exec", "motionq", "motion", "total"};
+	const uint32_t mhz = ESP.getCpuFreqMHz();
+	uint32_t n, sum;
+	int s, b, p50, p99;
+
+	for (s = 0; s < LAT_STAGES; ++s) {
+		n = m_count[s];
+		p50 = p99 = -1;
+		sum = 0;
+		for (b = 0; b < LAT_BUCKETS; ++b) {
+			sum += m_hist[s][b];
+			if ((p50 < 0) && (sum * 2 >= n)) p50 = b;
+			if ((p99 < 0) && (sum * 100 >= n * 99)) p99 = b;
+		}
+		/* Percentiles in the open ended bucket are bounded by max */
+		uint32_t u50 = (p50 == LAT_BUCKETS - 1) ? (m_max[s] / mhz) : bucketUs(p50, mhz);
+		uint32_t u99 = (p99 == LAT_BUCKETS - 1) ? (m_max[s] / mhz) : bucketUs(p99, mhz);
+		w.printf("LAT,%s,n=%u,max=%uus,p50<=%uus,p99<=%uus,hist=", names[s], n, m_max[s] / mhz, n ? u50 : 0, n ? u99 : 0);
+		/* "<bound us:count" per used bucket, the last bucket is open ended */
+		for (b = 0; b < LAT_BUCKETS; ++b) {
+			if (!m_hist[s][b]) continue;
+			if (b == LAT_BUCKETS - 1) {
+				w.printf(">%u:%u ", bucketUs(b - 1, mhz), m_hist[s][b]);
+			} else {
+				w.printf("<%u:%u ", bucketUs(b, mhz), m_hist[s][b]);
+			}
+		}
+		w.add("\r\n");
+	}
+}
+//====================================================================================
@@ -8,24 +8,186 @@
  * published by the Free Software Foundation.
  */
 #include "NetworkCommand.h"
+#include "ResponseWriter.h"
 
-void NetworkCommand::handleData(char *data, int n) 
+//====================================================================================
+//=============================-- TCP session --======================================
+//====================================================================================
+
+void NetworkSession::attach(CommandDB *db, AsyncClient *client)
+{
+	m_db       = db;
+	m_client   = client;
+	m_lastSeq  = -1;
+	m_creditInterval = 0;
+	m_creditSent     = -1;
+	m_overflow = false;
+	m_txHead   = m_txTail = 0;
+	resetLatency();
+	setBinaryMode(false);                  // New connection starts in text mode
+	client->setNoDelay(true);
+	client->onDisconnect([](void* arg, AsyncClient* client) {
+		cmddebug("TCP:DisConnect\n");
+		((NetworkSession *)arg)->detach();
+		delete client;
+	}, this);
+	client->onData([](void *arg, AsyncClient* client, void *data, size_t len) {
+		((NetworkSession *)arg)->handleData((const char *)data, (int)len);
+	}, this);
+	client->onAck([](void *arg, AsyncClient* client, size_t len, uint32_t time) {
+		NetworkSession *s = (NetworkSession *)arg;
+		s->m_txAcked += len;
+		s->flush();                        // Window opened
+	}, this);
+}
+//====================================================================================
+
+void NetworkSession::detach()
+{
+	/* Commands still queued by this session run, their replies are dropped */
+	if (m_db) m_db->detach(this);
+	m_client = NULL;
+	m_txHead = m_txTail = 0;
+}
+//====================================================================================
+
+void NetworkSession::write(const uint8_t *data, int len)
+{
+	uint32_t pos, n;
+
+	if (!m_client) return;
+	if ((uint32_t)len > (NET_TX_BUFFER - txPending())) {
+		flush();                           // Make room if TCP takes something now
+		if ((uint32_t)len > (NET_TX_BUFFER - txPending())) {
+			m_txDropped += len;
+			m_txDroppedMsg++;
+			return;
+		}
+	}
+	pos = m_txHead & (NET_TX_BUFFER - 1);
+	n   = NET_TX_BUFFER - pos;
+	if (n > (uint32_t)len) n = len;
+	memcpy(m_tx + pos, data, n);
+	if (n < (uint32_t)len) memcpy(m_tx, data + n, len - n);
+	m_txHead += len;
+	if (txPending() >= NET_TX_FLUSH) flush();
+}
+//====================================================================================
+
+void NetworkSession::flush()
+{
+	uint32_t pos, n, room;
+	bool added = false;
+
+	if (!m_client) return;
+	while (txPending()) {
+		room = m_client->space();
+		if (room == 0) break;
+		pos = m_txTail & (NET_TX_BUFFER - 1);
+		n   = NET_TX_BUFFER - pos;         // Contiguous part
+		if (n > txPending()) n = txPending();
+		if (n > room) n = room;
+		n = m_client->add((const char *)m_tx + pos, n);
+		if (n == 0) break;
+		m_txTail      += n;
+		m_txDelivered += n;
+		added = true;
+	}
+	if (added) m_client->send();
+}
+//====================================================================================
+
+//====================================================================================
+//=============================-- TCP server --=======================================
+//====================================================================================
+
+NetworkCommand::NetworkCommand(CommandDB *db, int port, int maxClients): m_db(db), m_maxClients(2), m_rejected(0)
+{
+	setMaxClients(maxClients);
+	m_server = new AsyncServer(port);
+	m_server->onClient([](void* arg, AsyncClient* client) {
+		cmddebug("TCP:New client\n");
+		((NetworkCommand *)arg)->onClient(client);
+	}, this);
+	m_server->begin();
+}
+//====================================================================================
+
+NetworkCommand::~NetworkCommand()
+{
+	delete m_server;
+}
+//====================================================================================
+
+void NetworkCommand::onClient(AsyncClient *client)
 {
 	int i;
-	
-	for (i=0; i < n; ++i) {
-		char inChar = data[i];
-		if ((inChar == '\r') || (inChar == '\n')) {
-			if (bufPos) {
-				buffer[bufPos] = '\0';
-				m_db->executeCommand(this, buffer);
-				clearBuffer();
-			}
-		} else if (isprint(inChar)) {     // Only printable characters into the buffer
-			if (bufPos < COMMAND_BUFFER) {
-				buffer[bufPos++] = inChar;  // Put character into buffer
-			}
+
+	for (i = 0; i < m_maxClients; ++i) {
+		if (!m_sessions[i].active()) {
+			m_sessions[i].attach(m_db, client);
+			return;
 		}
 	}
+	/* Limit reached */
+	m_rejected++;
+	client->onDisconnect([](void* arg, AsyncClient* client) {delete client;}, NULL);
+	static const char msg[] = "!8 Err: Too many clients\r\n";
+	client->write(msg, sizeof(msg) - 1);
+	client->close();
+}
+//====================================================================================
+
+bool NetworkCommand::setMaxClients(int n)
+{
+	if ((n < 1) || (n > NET_MAX_CLIENTS)) return false;
+	m_maxClients = n;
+	return true;
+}
+//====================================================================================
+
+int NetworkCommand::clients()
+{
+	int i, n = 0;
+
+	for (i = 0; i < NET_MAX_CLIENTS; ++i) if (m_sessions[i].active()) n++;
+	return n;
+}
+//====================================================================================
+
+void NetworkCommand::loop()
+{
+	int i;
+
+	for (i = 0; i < NET_MAX_CLIENTS; ++i) {
+		if (m_sessions[i].active()) m_sessions[i].flush();
+	}
+}
+//====================================================================================
+
+void NetworkCommand::printStat(CommandQueueItem *c)
+{
+	ResponseWriter w(c);
+	int i;
+
+	w.printf("NC,%d/%d,rejected=%u\r\n", clients(), m_maxClients, m_rejected);
+	for (i = 0; i < NET_MAX_CLIENTS; ++i) {
+		NetworkSession &s = m_sessions[i];
+		if (!s.active()) continue;
+		w.printf("NS%d,pending=%u,delivered=%u,acked=%u,dropped=%u/%u,", i, s.txPending(), s.m_txDelivered, s.m_txAcked, s.m_txDropped, s.m_txDroppedMsg);
+		s.printLatency(w);
+		w.add("\r\n");
+	}
+	w.ok();
+}
+//====================================================================================
+
+void NetworkCommand::creditTick(int credits)
+{
+	int i;
+
+	for (i = 0; i < NET_MAX_CLIENTS; ++i) {
+		if (m_sessions[i].active()) m_sessions[i].creditTick(credits);
+	}
 }
 //====================================================================================
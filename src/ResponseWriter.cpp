@@ -0,0 +1,93 @@
+/*
+ * Fixed buffer response writer (replies without String temporaries).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "Command.h"
+#include <stdio.h>
+
+ResponseWriter::ResponseWriter(Command *c, int32_t seq): m_cmd(c), m_len(0), m_prefix(0)
+{
+	if (seq >= 0) m_len = m_prefix = snprintf(m_buf, RESPONSE_BUFFER + 1, "N%d ", seq);
+}
+//====================================================================================
+
+ResponseWriter::ResponseWriter(CommandQueueItem *c): ResponseWriter(c->m_parent, c->m_seq)
+{
+}
+//====================================================================================
+
+ResponseWriter &ResponseWriter::vprintf(const char *fmt, va_list ap)
+{
+	va_list aq;
+	int n;
+
+	va_copy(aq, ap);
+	n = vsnprintf(m_buf + m_len, RESPONSE_BUFFER + 1 - m_len, fmt, aq);
+	va_end(aq);
+	if (n < 0) return *this;
+	if ((m_len + n) <= RESPONSE_BUFFER) {
+		m_len += n;
+		return *this;
+	}
+	/* Does not fit - send what we have and format again at the start of the buffer
+	   (behind "N<seq> " when nothing else was buffered, flush() keeps it) */
+	flush();
+	n = vsnprintf(m_buf + m_len, RESPONSE_BUFFER + 1 - m_len, fmt, ap);
+	if (n > (RESPONSE_BUFFER - m_len)) n = RESPONSE_BUFFER - m_len;   // Truncated (single piece longer than the buffer)
+	if (n > 0) m_len += n;
+	return *this;
+}
+//====================================================================================
+
+ResponseWriter &ResponseWriter::printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	return *this;
+}
+//====================================================================================
+
+ResponseWriter &ResponseWriter::add(const char *s, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = RESPONSE_BUFFER - m_len;
+		if (n == 0) {
+			flush();
+			continue;
+		}
+		if (n > len) n = len;
+		memcpy(m_buf + m_len, s, n);
+		m_len += n;
+		s     += n;
+		len   -= n;
+	}
+	return *this;
+}
+//====================================================================================
+
+ResponseWriter &ResponseWriter::add(const char *s)
+{
+	return add(s, strlen(s));
+}
+//====================================================================================
+
+void ResponseWriter::flush()
+{
+	if (m_len > m_prefix) {
+		m_buf[m_len] = '\0';
+		m_cmd->print(m_buf, m_len);
+		m_prefix = 0;              // Continuation without the sequence number
+	}
+	m_len = m_prefix;
+}
+//====================================================================================
@@ -0,0 +1,89 @@
+/*
+ * SerialCommand - Execute commands over the UART (wired fallback for TCP).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "SerialCommand.h"
+
+void SerialCommand::begin(uint32_t baud)
+{
+	m_baud = baud;
+	m_port.setRxBufferSize(SERIAL_RX_BUFFER);
+	m_port.begin(baud);
+}
+//====================================================================================
+
+void SerialCommand::loop()
+{
+	char chunk[SERIAL_READ_CHUNK];
+	int i, n;
+
+	if (m_port.hasOverrun()) {
+		m_rxOverruns++;
+		print("!8 Err: Receive overrun\r\n");
+	}
+	for (i = 0; i < SERIAL_READ_LOOPS; ++i) {
+		n = m_port.available();
+		if (n <= 0) break;
+		if ((uint32_t)n > m_rxPeak) m_rxPeak = n;
+		if (n > SERIAL_READ_CHUNK) n = SERIAL_READ_CHUNK;
+		n = m_port.read(chunk, n);
+		if (n <= 0) break;
+		m_rxBytes += n;
+		handleData(chunk, n);
+	}
+	flush();
+}
+//====================================================================================
+
+void SerialCommand::write(const uint8_t *data, int len)
+{
+	uint32_t pos, n;
+
+	if ((uint32_t)len > (SERIAL_TX_BUFFER - txPending())) {
+		flush();                           // Make room if the FIFO takes something now
+		if ((uint32_t)len > (SERIAL_TX_BUFFER - txPending())) {
+			m_txDropped += len;
+			m_txDroppedMsg++;
+			return;
+		}
+	}
+	pos = m_txHead & (SERIAL_TX_BUFFER - 1);
+	n   = SERIAL_TX_BUFFER - pos;
+	if (n > (uint32_t)len) n = len;
+	memcpy(m_tx + pos, data, n);
+	if (n < (uint32_t)len) memcpy(m_tx, data + n, len - n);
+	m_txHead += len;
+	flush();
+}
+//====================================================================================
+
+void SerialCommand::flush()
+{
+	uint32_t pos, n, room;
+
+	while (txPending()) {
+		room = m_port.availableForWrite();
+		if (room == 0) break;
+		pos = m_txTail & (SERIAL_TX_BUFFER - 1);
+		n   = SERIAL_TX_BUFFER - pos;      // Contiguous part
+		if (n > txPending()) n = txPending();
+		if (n > room) n = room;
+		n = m_port.write(m_tx + pos, n);
+		if (n == 0) break;
+		m_txTail += n;
+	}
+}
+//====================================================================================
+
+void SerialCommand::printStat(ResponseWriter &w)
+{
+	w.printf("SER,baud=%u,rx=%u,peak=%u/%u,overruns=%u,pending=%u,dropped=%u/%u,", m_baud, m_rxBytes, m_rxPeak, SERIAL_RX_BUFFER, m_rxOverruns, txPending(), m_txDropped, m_txDroppedMsg);
+	printLatency(w);
+	w.add("\r\n");
+}
+//====================================================================================
@@ -0,0 +1,108 @@
+/*
+ * AccelStepper step backend (polled from the main loop).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "StepBackend.h"
+#include "AccelStepper.h" // nice lib from http://www.airspayce.com/mikem/arduino/AccelStepper/
+
+void StepAccel::begin(int step, int dir, const motion_isr_pair_t &isr)
+{
+	m_xMotor = new AccelStepper(1, step, dir);
+	m_xMotor->setMaxSpeed(2000.0);
+	m_xMotor->setAcceleration(10000.0);
+}
+//====================================================================================
+
+bool StepAccel::start(uint16_t duration, int xSteps)
+{
+	if (m_xMotor->distanceToGo()) return false;
+	if (duration == 0) duration = 100;
+	//set Coordinates and Speed
+	m_xMotor->move(xSteps);
+	if (xSteps < 0) xSteps = -xSteps;
+	m_xMotor->setSpeed( (xSteps * 1000.0) / duration );
+	return true;
+}
+//====================================================================================
+
+bool StepAccel::busy()
+{
+	if ( m_xMotor->distanceToGo() ) {
+		m_xMotor->runSpeedToPosition();
+		return true;
+	}
+	return false;
+}
+//====================================================================================
+
+void StepAccel::halt()
+{
+	m_xMotor->moveTo(m_xMotor->currentPosition());
+}
+//====================================================================================
+
+void StepAccel::snapshot(motion_snapshot_t *snap)
+{
+	/* AccelStepper runs in the loop context, nothing can tear the read */
+	snap->pos       = m_xMotor->currentPosition();
+	snap->target    = m_xMotor->targetPosition();
+	snap->active    = (m_xMotor->distanceToGo() != 0);
+	snap->speed     = snap->active ? (uint32_t)fabs(m_xMotor->speed()) : 0;
+	snap->hperiod   = snap->speed ? (40000000u / snap->speed) : 0;
+	snap->phase     = 0;
+	snap->in_motion = snap->active;
+	snap->retries   = 0;
+}
+//====================================================================================
+
+int StepAccel::position()
+{
+	return m_xMotor->currentPosition();
+}
+//====================================================================================
+
+void StepAccel::setZero()
+{
+	m_xMotor->setCurrentPosition(0);
+}
+//====================================================================================
+
+/*!
+ * \brief Constant rate run, polling runSpeed() the way loop() does.
+ */
+bool StepAccel::benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r)
+{
+	long pos = m_xMotor->currentPosition();
+	uint32_t t0, t, c, prev, period = hperiod << 1, late;
+
+	if (m_xMotor->distanceToGo()) return false;
+	m_xMotor->move(steps);
+	m_xMotor->setSpeed(80000000.0 / period);
+	t0 = prev = GetCycleCount();
+	while (m_xMotor->distanceToGo()) {
+		t = GetCycleCount();
+		if (m_xMotor->runSpeedToPosition()) {
+			c = GetCycleCount();
+			r->busy += c - t;
+			/* Interval error against the requested period */
+			late = (c - prev) > period ? (c - prev) - period : 0;
+			if (r->steps && (late > r->late_max)) r->late_max = late;
+			if (r->steps) r->late_sum += late;
+			r->steps++;
+			prev = c;
+		} else {
+			r->busy += GetCycleCount() - t;
+		}
+		/* Stop runs far beyond the expected time */
+		if ((GetCycleCount() - t0) > (steps * period * 4 + 8000000)) break;
+	}
+	r->elapsed = GetCycleCount() - t0;
+	m_xMotor->setCurrentPosition(pos);
+	return true;
+}
+//====================================================================================
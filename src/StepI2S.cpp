@@ -0,0 +1,215 @@
+/*
+ * I2S DMA step backend (hardware clocked STEP edges).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "StepBackend.h"
+#include "ResponseWriter.h"
+#include "esp8266_gpio_direct.h"
+#include <i2s.h>
+
+void StepI2S::begin(int step, int dir, const motion_isr_pair_t &isr)
+{
+	pinMode(dir, OUTPUT);
+	m_dir_mask = (1 << dir);
+	memset(&m_st, 0, sizeof(m_st));
+	m_running  = false;
+	m_underrun = 0;
+	m_bench    = NULL;
+	m_bufPos   = I2S_STEP_CHUNK;
+	i2s_begin();
+	i2s_set_rate(I2S_STEP_RATE);
+	/* Slots per CPU cycle (80MHz) in Q16 */
+	m_slot_q16 = (uint32_t)(((uint64_t)I2S_STEP_RATE * 32 * 65536) / 80000000u);
+}
+//====================================================================================
+
+/*!
+ * \brief Next step interval in slots (called by the encoder).
+ */
+bool StepI2S::next(uint32_t *interval)
+{
+	motion_state_t *s = &m_st;
+	uint64_t q;
+	uint32_t period;
+
+	if (s->pos == s->target) return false;
+	period = s->hperiod;
+	if (s->pos > s->target) s->pos--; else s->pos++;
+#ifdef USE_RAMP
+	if (s->ramp_phase) motion_ramp_update_t<true>(s);
+#endif
+	period += s->hperiod;
+	/* Cycles -> slots, keep the fraction */
+	q = (uint64_t)period * m_slot_q16 + m_frac;
+	*interval = (uint32_t)(q >> 16);
+	m_frac    = (uint32_t)(q & 0xffff);
+	if (m_bench) {
+		/* Quantization error of this edge [cycles] */
+		uint32_t late = (uint32_t)(((uint64_t)m_frac * 80000000u) / ((uint64_t)I2S_STEP_RATE * 32 * 65536));
+		if (late > m_bench->late_max) m_bench->late_max = late;
+		m_bench->late_sum += late;
+	}
+	return true;
+}
+//====================================================================================
+
+void StepI2S::run(bool start)
+{
+	if (start) {
+		m_encoder.reset();
+		m_frac    = 0;
+		m_bufPos  = I2S_STEP_CHUNK;
+		m_tail    = I2S_STEP_TAIL;
+		m_running = true;
+	}
+	refill();
+}
+//====================================================================================
+
+/*!
+ * \brief Push encoded words until the DMA ring is full.
+ */
+void StepI2S::refill()
+{
+	if (i2s_available() >= I2S_STEP_TAIL) m_underrun++;
+	for (;;) {
+		if (m_bufPos == I2S_STEP_CHUNK) {
+			if (m_tail <= 0) {
+				m_running = false;
+				return;
+			}
+			uint32_t n = m_encoder.encode(m_buf, I2S_STEP_CHUNK, *this);
+			if (m_bench) m_bench->steps += n;
+			if ((n == 0) && m_encoder.idle() && (m_st.pos == m_st.target)) m_tail -= I2S_STEP_CHUNK;
+			m_bufPos = 0;
+		}
+		if (!i2s_write_sample_nb(m_buf[m_bufPos])) return;
+		m_bufPos++;
+	}
+}
+//====================================================================================
+
+/*!
+ * \brief Plan the move (same period and ramp rules as timer1, without MIN_PERIOD).
+ */
+bool StepI2S::start(uint16_t duration, int xSteps)
+{
+	motion_state_t *s = &m_st;
+	uint64_t tmp;
+
+	if (m_running) return false;
+	if (duration == 0) duration = 100;
+	s->target += xSteps;
+	if (s->target > s->pos) gpio_r->out_w1ts = m_dir_mask; else gpio_r->out_w1tc = m_dir_mask;
+#ifdef USE_RAMP
+	s->pos_start = s->pos;
+	if (s->target > s->pos) {
+		s->dir = 1;
+		s->pos_middle = s->pos - 2 + ((s->target - s->pos)>>1);
+	} else {
+		s->dir = 0;
+		s->pos_middle = s->pos + 2 - ((s->pos - s->target)>>1);
+	}
+	s->ramp_pos   = 0;
+	s->ramp_iter  = 0;
+	s->ramp_phase = 0;
+#endif
+	if (xSteps < 0) xSteps = -xSteps;
+	if (xSteps) {
+		tmp = duration;
+		tmp *= 80000;
+		tmp /= xSteps;
+	} else {
+		tmp = 160000;
+	}
+	/* Shortest period the encoder can express */
+	if (tmp < (uint64_t)((I2S_STEP_PULSE + 1) * 80000000u) / (I2S_STEP_RATE * 32) + 1) {
+		tmp = ((I2S_STEP_PULSE + 1) * 80000000u) / (I2S_STEP_RATE * 32) + 1;
+	}
+	s->hperiod = (uint32_t)(tmp >> 1);
+#ifdef USE_RAMP
+	if (tmp < RSTART_STOP_PERIOD) {
+		s->target_hperiod = s->hperiod;
+		s->ramp_phase     = 1;
+		s->hperiod        = RSTART_STOP_HPERIOD;
+	}
+#endif
+	run(true);
+	return true;
+}
+//====================================================================================
+
+bool StepI2S::busy()
+{
+	if (m_running) refill();
+	return m_running;
+}
+//====================================================================================
+
+void StepI2S::halt()
+{
+	/* Words already in the DMA ring (max I2S_STEP_TAIL samples) still play out */
+	m_st.target = m_st.pos;
+}
+//====================================================================================
+
+void StepI2S::snapshot(motion_snapshot_t *snap)
+{
+	/* Planner state, runs ahead of the motor by the DMA ring length */
+	snap->pos       = m_st.pos;
+	snap->target    = m_st.target;
+	snap->active    = m_running;
+	snap->hperiod   = m_running ? m_st.hperiod : 0;
+	snap->speed     = (m_running && m_st.hperiod) ? (40000000u / m_st.hperiod) : 0;
+#ifdef USE_RAMP
+	snap->phase     = m_st.ramp_phase;
+#else
+	snap->phase     = 0;
+#endif
+	snap->in_motion = m_running;
+	snap->retries   = 0;
+}
+//====================================================================================
+
+void StepI2S::stat(ResponseWriter &w)
+{
+	w.printf("i2s_underrun=%u\r\n", m_underrun);
+}
+//====================================================================================
+
+/*!
+ * \brief Constant rate run. Jitter is the slot quantization, CPU is the refill time.
+ */
+bool StepI2S::benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r)
+{
+	int32_t pos = m_st.pos, target = m_st.target;
+	uint32_t t0, t;
+
+	if (m_running) return false;
+	m_st.target     = m_st.pos + steps;
+#ifdef USE_RAMP
+	m_st.ramp_phase = 0;
+#endif
+	m_st.hperiod    = hperiod;
+	m_bench         = r;
+	t0 = GetCycleCount();
+	run(true);
+	r->busy += GetCycleCount() - t0;
+	while (m_running) {
+		t = GetCycleCount();
+		refill();
+		r->busy += GetCycleCount() - t;
+		yield();
+	}
+	r->elapsed = GetCycleCount() - t0;
+	m_bench    = NULL;
+	m_st.pos    = pos;
+	m_st.target = target;
+	return true;
+}
+//====================================================================================
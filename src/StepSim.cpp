@@ -0,0 +1,82 @@
+/*
+ * Simulated step backend (no hardware, position advances with time).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "StepBackend.h"
+
+bool StepSim::start(uint16_t duration, int xSteps)
+{
+	if (m_pos != m_target) return false;
+	m_target += xSteps;
+	m_period  = step_period(duration, xSteps);
+	m_next    = GetCycleCount() + m_period;
+	return true;
+}
+//====================================================================================
+
+/*!
+ * \brief Emit every step that is due (returns number of steps).
+ */
+uint32_t StepSim::run(step_bench_t *r)
+{
+	uint32_t now = GetCycleCount(), n = 0;
+
+	while ((m_pos != m_target) && ((int32_t)(now - m_next) >= 0)) {
+		if (r) {
+			uint32_t late = now - m_next;
+			if (late > r->late_max) r->late_max = late;
+			r->late_sum += late;
+		}
+		if (m_pos > m_target) m_pos--; else m_pos++;
+		m_next += m_period;
+		n++;
+	}
+	return n;
+}
+//====================================================================================
+
+bool StepSim::busy()
+{
+	run(NULL);
+	return (m_pos != m_target);
+}
+//====================================================================================
+
+void StepSim::snapshot(motion_snapshot_t *snap)
+{
+	snap->pos       = m_pos;
+	snap->target    = m_target;
+	snap->active    = (m_pos != m_target);
+	snap->hperiod   = snap->active ? (m_period >> 1) : 0;
+	snap->speed     = snap->active ? (80000000u / m_period) : 0;
+	snap->phase     = 0;
+	snap->in_motion = snap->active;
+	snap->retries   = 0;
+}
+//====================================================================================
+
+bool StepSim::benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r)
+{
+	int32_t pos = m_pos;
+	uint32_t t0, t;
+
+	if (m_pos != m_target) return false;
+	m_target = m_pos + steps;
+	m_period = hperiod << 1;
+	t0 = GetCycleCount();
+	m_next = t0 + m_period;
+	while (m_pos != m_target) {
+		t = GetCycleCount();
+		r->steps += run(r);
+		r->busy  += GetCycleCount() - t;
+	}
+	r->elapsed = GetCycleCount() - t0;
+	m_pos = m_target = pos;
+	return true;
+}
+//====================================================================================
@@ -0,0 +1,349 @@
+/*
+ * Timer1 ISR step backend (fast, tabled ramp).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "StepBackend.h"
+#include "ResponseWriter.h"
+#include "core_esp8266_waveform.h"
+
+#if 1
+#define motiondebug(fmt, args...)
+#else
+#define motiondebug(fmt, args...) Serial.printf(fmt, ## args)
+#endif
+
+/* ISR state */
+motion_state_t             mx;
+
+void StepTimer1::begin(int step, int dir, const motion_isr_pair_t &isr)
+{
+	pinMode(step, OUTPUT);
+	pinMode(dir, OUTPUT);
+	digitalWrite(step, LOW);
+	m_dir_mask      = (1 << dir);
+	m_isr           = isr;
+	/* Disable timer */
+	setTimer1Callback(NULL);
+	memset(&mx, 0, sizeof(mx));
+	mx.step_mask    = (1 << step);
+	mx.period_q8    = 256;
+	m_in_motion     = 0;
+	m_setMicrosteps = NULL;
+	m_ustepSwitches = 0;
+	m_ustepErrors   = 0;
+	m_fault         = NULL;
+	resetProfile();
+}
+//====================================================================================
+
+void StepTimer1::resetProfile()
+{
+	MX->prof_min = 0xffffffff; MX->prof_max = 0; MX->prof_sum = 0; MX->prof_cnt = 0;
+	MX->late_max = 0; MX->late_sum = 0; MX->late_cnt = 0;
+}
+//====================================================================================
+
+/*!
+ * \brief Prepare and start move.
+ */
+bool StepTimer1::start(uint16_t duration, int xSteps)
+{
+	uint32_t tmp;
+	motion_state_t *s = &mx;
+
+	if (m_in_motion) return false;
+	setTimer1Callback(NULL);
+	/* Driver left at cruise microsteps by a failed switch: no move until it is back */
+	if (MX->ushift && !switchMicrosteps(false)) return false;
+	motion_write_begin(s);
+	s->active       = 0;
+	s->pulse        = 0;
+	s->hold         = 0;
+	/* Set target */
+	s->target += xSteps;
+	/* Set direction pin */
+	if (s->target > s->pos) gpio_r->out_w1ts = m_dir_mask; else gpio_r->out_w1tc = m_dir_mask;
+#ifdef USE_RAMP
+	s->pos_start = s->pos;
+	if (s->target > s->pos) {
+		s->dir = 1;
+		s->pos_middle = s->pos - 2 + ((s->target - s->pos)>>1);
+	} else {
+		s->dir = 0;
+		s->pos_middle = s->pos + 2 - ((s->pos - s->target)>>1);
+	}
+	s->ramp_pos   = 0;
+	s->ramp_iter  = 0;
+	s->ramp_phase = 0;
+#endif	
+	tmp = step_period(duration, xSteps);
+#ifdef USE_RAMP
+	if (tmp < RMAXIMUM_PERIOD) tmp = RMAXIMUM_PERIOD;
+
+	if (tmp < RSTART_STOP_PERIOD) {
+		s->target_hperiod = RMAXIMUM_HPERIOD;
+		s->ramp_phase     = 1;
+		tmp = RSTART_STOP_PERIOD;
+	}
+#endif
+	/* Calculate half period */
+	s->hperiod = (tmp >> 1);
+
+	/* Start timer1 */
+	m_in_motion = 1;
+	s->active   = 1;
+	s->time     = (GetCycleCount() + microsecondsToClockCycles(500));
+	motion_write_end(s);
+	motiondebug("GoTo %d, hperiod = %d, duration = %d, xsteps = %d\n\r",s->target, s->hperiod, duration, xSteps);
+	setTimer1Callback(m_isr.run);
+	return true;
+}
+//====================================================================================
+
+bool StepTimer1::busy()
+{
+	if (m_in_motion) {
+		switch (MX->ustep_state) {
+			case 1: switchMicrosteps(true); break;
+			case 3: switchMicrosteps(false); break;
+			default: break;
+		}
+		if (MX->active == 0) {
+			setTimer1Callback(NULL);
+			/* Stopped while coarse or paused (ushift stays if the driver did not take it, see start()) */
+			if (MX->ushift || MX->ustep_state) switchMicrosteps(false);
+			m_in_motion = 0;
+		}
+	}
+	return m_in_motion;
+}
+//====================================================================================
+
+/*!
+ * \brief Enable adaptive microstepping.
+ * At cruise speed the driver is switched to cruise microsteps (fewer interrupts,
+ * position still counted in native microsteps), before the ramp down it is
+ * switched back to native microsteps.
+ * Every switch stops the step train at cruise speed for the driver transaction
+ * (three datagrams) plus the loop latency, then stepping restarts at cruise speed.
+ * Use it only with enough torque reserve to start at the cruise rate.
+ * \param set    - reprogram the driver (blocking, called from loop), NULL - off.
+ * \param cruise - cruise resolution (native/cruise must be a power of 2), 0 - off.
+ */
+bool StepTimer1::adaptiveMicrosteps(int native, int cruise, bool (*set)(int microsteps))
+{
+	uint32_t shift = 0;
+
+	if (m_in_motion) return false;
+	if (MX->ushift && !switchMicrosteps(false)) return false;   // Driver still at cruise microsteps
+	if (set && (cruise > 0) && (cruise < native)) {
+		while ((cruise << (shift + 1)) <= native) shift++;
+		if ((cruise << shift) != native) return false;
+	}
+	m_setMicrosteps    = shift ? set : NULL;
+	m_nativeMicrosteps = native;
+	m_cruiseMicrosteps = shift ? cruise : native;
+	MX->ushift         = 0;
+	MX->ustep_state    = 0;
+	MX->ustep_cruise   = shift;
+	return true;
+}
+//====================================================================================
+
+/*!
+ * \brief Reprogram the driver while the ISR is paused and resume stepping.
+ * The step size (ushift) only changes when the driver confirmed the write.
+ * A failed switch back to native aborts the move (see fault()).
+ */
+bool StepTimer1::switchMicrosteps(bool coarse)
+{
+	bool ok = m_setMicrosteps && m_setMicrosteps(coarse ? m_cruiseMicrosteps : m_nativeMicrosteps);
+
+	m_ustepSwitches++;
+	if (ok) {
+		MX->ushift      = coarse ? MX->ustep_cruise : 0;
+		MX->ustep_state = coarse ? 2 : 0;
+		return true;
+	}
+	m_ustepErrors++;
+	if (coarse) {
+		/* Driver still at native resolution, no more coarse steps */
+		MX->ustep_cruise = 0;
+		MX->ustep_state  = 0;
+		return false;
+	}
+	/* Back to native failed: the driver still makes coarse steps, a ramp down is not possible.
+	   End the move here (ushift stays, start() retries the switch before the next move). */
+	uint32_t ps = motion_irq_lock();
+	motion_write_begin(&mx);
+	MX->target      = MX->pos;
+	MX->ustep_state = 0;
+	motion_write_end(&mx);
+	motion_irq_unlock(ps);
+	m_fault = "Microstep switch failed";
+	return false;
+}
+//====================================================================================
+
+void StepTimer1::halt()
+{
+	/* Soft stop (the ISR may be stepping, pos must not move between the read and the write) */
+	uint32_t ps = motion_irq_lock();
+	motion_write_begin(&mx);
+	MX->target = MX->pos;
+	motion_write_end(&mx);
+	motion_irq_unlock(ps);
+}
+//====================================================================================
+
+/*!
+ * \brief Feed hold: the ISR ramps down and stops stepping at the start/stop speed
+ * (target kept), resume ramps up again towards the target.
+ */
+bool StepTimer1::feedHold(bool on)
+{
+	motion_state_t *s = &mx;
+	uint32_t ps;
+
+	ps = motion_irq_lock();
+	if (on) {
+		if (MX->active && (MX->hold == 0)) MX->hold = 1;
+	} else if (MX->hold) {
+		/* Resume */
+		MX->hold = 0;
+#ifdef USE_RAMP
+		if (MX->ramp_phase) {
+			motion_write_begin(s);
+			s->pos_start = s->pos;
+			if (s->target > s->pos) {
+				s->pos_middle = s->pos - 2 + ((s->target - s->pos)>>1);
+			} else {
+				s->pos_middle = s->pos + 2 - ((s->pos - s->target)>>1);
+			}
+			s->ramp_phase = 1;
+			motion_write_end(s);
+		}
+#endif
+	}
+	motion_irq_unlock(ps);
+	return true;
+}
+//====================================================================================
+
+/*!
+ * \brief Feed override [%] (MOTION_OVERRIDE_MIN..MOTION_OVERRIDE_MAX), applied from the next edge.
+ */
+bool StepTimer1::feedOverride(int percent)
+{
+	if ((percent < MOTION_OVERRIDE_MIN) || (percent > MOTION_OVERRIDE_MAX)) return false;
+	MX->period_q8 = (256 * 100) / percent;
+	return true;
+}
+//====================================================================================
+
+void StepTimer1::setZero()
+{
+	uint32_t ps = motion_irq_lock();
+
+	motion_write_begin(&mx);
+	MX->align_off += MX->pos;
+	MX->pos    = 0;
+	MX->target = 0;
+	motion_write_end(&mx);
+	motion_irq_unlock(ps);
+}
+//====================================================================================
+
+void StepTimer1::snapshot(motion_snapshot_t *snap)
+{
+	volatile motion_state_t *s = MX;
+	uint32_t seq, retries = 0;
+
+	for (;;) {
+		seq = s->seq;
+		asm volatile ("" : : : "memory");
+		if ((seq & 1) == 0) {
+			snap->pos     = s->pos;
+			snap->target  = s->target;
+			snap->hperiod = s->hperiod;
+			snap->active  = s->active;
+#ifdef USE_RAMP
+			snap->phase   = s->ramp_phase;
+#else
+			snap->phase   = 0;
+#endif
+			asm volatile ("" : : : "memory");
+			if (seq == s->seq) break;
+		}
+		retries++;
+	}
+	snap->in_motion = m_in_motion;
+	snap->speed     = (snap->active && snap->hperiod) ? (40000000u / snap->hperiod) : 0;
+	snap->retries   = retries;
+}
+//====================================================================================
+
+void StepTimer1::stat(ResponseWriter &w)
+{
+	if (m_setMicrosteps) {
+		w.printf("ustep=%d/%d,switches=%u,errors=%u\r\n", m_nativeMicrosteps, m_cruiseMicrosteps, m_ustepSwitches, m_ustepErrors);
+	}
+#ifdef MOTION_ISR_PROFILE
+	/* ISR run time in cycles (min/avg/max) since the previous status */
+	uint32_t cnt = MX->prof_cnt;
+	w.printf("isr_cycles=%u/%u/%u\r\n", cnt ? MX->prof_min : 0, cnt ? (MX->prof_sum / cnt) : 0, MX->prof_max);
+	resetProfile();
+#endif
+}
+//====================================================================================
+
+/*!
+ * \brief Constant rate run with the profiling ISR (position is restored afterwards).
+ */
+bool StepTimer1::benchRun(uint32_t hperiod, uint32_t steps, step_bench_t *r)
+{
+	motion_state_t *s = &mx;
+	int32_t pos, target;
+	uint32_t t0, q8;
+
+	if (busy()) return false;
+	pos    = MX->pos;
+	target = MX->target;
+	q8     = MX->period_q8;
+	resetProfile();
+	motion_write_begin(s);
+	s->pulse      = 0;
+	s->hold       = 0;
+	s->period_q8  = 256;
+	s->target     = s->pos + steps;
+#ifdef USE_RAMP
+	s->ramp_phase = 0;
+#endif
+	s->hperiod    = hperiod;
+	s->active     = 1;
+	t0 = GetCycleCount();
+	s->time       = t0 + microsecondsToClockCycles(100);
+	motion_write_end(s);
+	setTimer1Callback(m_isr.profile);
+	while (MX->active) yield();
+	r->elapsed  = GetCycleCount() - t0;
+	setTimer1Callback(NULL);
+	r->steps    = MX->late_cnt;
+	r->late_max = MX->late_max;
+	r->late_sum = MX->late_sum;
+	r->busy     = MX->prof_sum;
+	/* Restore position */
+	motion_write_begin(s);
+	s->pos       = pos;
+	s->target    = target;
+	s->period_q8 = q8;
+	motion_write_end(s);
+	resetProfile();
+	return true;
+}
+//====================================================================================
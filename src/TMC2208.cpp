@@ -0,0 +1,140 @@
+/*
+ * TMC2208 stepper driver configuration over the single wire PDN_UART.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "TMC2208.h"
+
+#define TMC2208_SYNC        (0x05)
+#define TMC2208_MASTER      (0xff)
+#define TMC2208_WRITE       (0x80)
+#define TMC2208_TIMEOUT_MS  (5)
+
+/*!
+ * \brief Datagram CRC8 (polynomial x^8 + x^2 + x + 1, LSB first - datasheet 4.2).
+ */
+uint8_t TMC2208::crc(const uint8_t *data, size_t len)
+{
+	uint8_t c = 0, b;
+	size_t i, j;
+
+	for (i = 0; i < len; ++i) {
+		b = data[i];
+		for (j = 0; j < 8; ++j) {
+			if ((c >> 7) ^ (b & 0x01)) c = (c << 1) ^ 0x07; else c = (c << 1);
+			b >>= 1;
+		}
+	}
+	return c;
+}
+//====================================================================================
+
+/*!
+ * \brief MRES field for microstep resolution (-1 - not a power of 2 in 1..256).
+ */
+int TMC2208::mres(int microsteps)
+{
+	int m = 8;
+
+	while (m >= 0) {
+		if (microsteps == (1 << (8 - m))) return m;
+		m--;
+	}
+	return -1;
+}
+//====================================================================================
+
+/*!
+ * \brief Send write datagram (no answer, see writeRegister()).
+ */
+bool TMC2208::sendWrite(uint8_t reg, uint32_t value)
+{
+	uint8_t d[8];
+
+	d[0] = TMC2208_SYNC;
+	d[1] = m_slave;
+	d[2] = reg | TMC2208_WRITE;
+	d[3] = (value >> 24) & 0xff;
+	d[4] = (value >> 16) & 0xff;
+	d[5] = (value >> 8) & 0xff;
+	d[6] = value & 0xff;
+	d[7] = crc(d, 7);
+	m_uart->clear();
+	if (m_uart->write(d, 8) != 8) {
+		m_errors++;
+		return false;
+	}
+	return true;
+}
+//====================================================================================
+
+bool TMC2208::writeRegister(uint8_t reg, uint32_t value)
+{
+	uint32_t before, after;
+
+	/* A write is not answered, IFCNT (8 bit) counts the datagrams the driver took */
+	if (!readRegister(TMC2208_IFCNT, &before)) return false;
+	if (!sendWrite(reg, value)) return false;
+	if (!readRegister(TMC2208_IFCNT, &after)) return false;
+	if (((after - before) & 0xff) != 1) {
+		m_errors++;
+		return false;
+	}
+	return true;
+}
+//====================================================================================
+
+bool TMC2208::readRegister(uint8_t reg, uint32_t *value)
+{
+	uint8_t d[8];
+	int i, c;
+
+	d[0] = TMC2208_SYNC;
+	d[1] = m_slave;
+	d[2] = reg & 0x7f;
+	d[3] = crc(d, 3);
+	m_uart->clear();
+	if (m_uart->write(d, 4) != 4) goto err;
+	/* Skip our own request (single wire echo, only on ports that receive it) */
+	for (i = 0; m_uart->echo() && (i < 4); ++i) {
+		if (m_uart->read(TMC2208_TIMEOUT_MS) < 0) goto err;
+	}
+	for (i = 0; i < 8; ++i) {
+		if ((c = m_uart->read(TMC2208_TIMEOUT_MS)) < 0) goto err;
+		d[i] = c;
+	}
+	if ((d[0] != TMC2208_SYNC) || (d[1] != TMC2208_MASTER) || (d[2] != (reg & 0x7f)) || (d[7] != crc(d, 7))) goto err;
+	*value = ((uint32_t)d[3] << 24) | ((uint32_t)d[4] << 16) | ((uint32_t)d[5] << 8) | d[6];
+	return true;
+err:
+	m_errors++;
+	return false;
+}
+//====================================================================================
+
+bool TMC2208::begin(int microsteps)
+{
+	m_errors = 0;
+	if (!writeRegister(TMC2208_GCONF, TMC2208_GCONF_I_SCALE_ANALOG | TMC2208_GCONF_PDN_DISABLE | \
+		TMC2208_GCONF_MSTEP_REG_SELECT | TMC2208_GCONF_MULTISTEP_FILT)) return false;
+	return setMicrosteps(microsteps);
+}
+//====================================================================================
+
+bool TMC2208::setMicrosteps(int microsteps)
+{
+	int m = mres(microsteps);
+	uint32_t v;
+
+	if (m < 0) return false;
+	v = (m_chopconf & ~TMC2208_CHOPCONF_MRES_MASK) | ((uint32_t)m << TMC2208_CHOPCONF_MRES_SHIFT);
+	if (!writeRegister(TMC2208_CHOPCONF, v)) return false;
+	m_chopconf   = v;
+	m_microsteps = microsteps;
+	return true;
+}
+//====================================================================================
@@ -0,0 +1,239 @@
+/*
+ * UDPCommand - Execute commands sent in UDP datagrams (sequence numbers, ACK).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "UDPCommand.h"
+#include "ResponseWriter.h"
+
+//====================================================================================
+//==============================-- UDP peer --========================================
+//====================================================================================
+
+void UDPPeer::attach(CommandDB *db, AsyncUDP *udp, uint32_t ip, uint16_t port)
+{
+	m_db       = db;
+	m_udp      = udp;
+	m_ip       = ip;
+	m_port     = port;
+	m_last     = millis();
+	m_seqHigh  = -1;
+	m_seqMask  = 0;
+	m_txLen    = 0;
+	m_lastSeq  = -1;
+	m_creditInterval = 0;
+	m_creditSent     = -1;
+	m_overflow = false;
+	m_datagrams = m_dups = m_txDatagrams = 0;
+	resetLatency();
+	clearBuffer();
+}
+//====================================================================================
+
+void UDPPeer::detach()
+{
+	if (!m_udp) return;
+	m_db->detach(this);
+	m_udp = NULL;
+}
+//====================================================================================
+
+bool UDPPeer::seen(int32_t seq) const
+{
+	int32_t d = seq - m_seqHigh;
+
+	/* Newer one (or the sender started again from a low number) */
+	if ((m_seqHigh < 0) || (d > 0) || (d <= -UDP_SEQ_RESTART)) return false;
+	d = -d;
+	if (d >= UDP_SEQ_WINDOW) return true;           // Too old to tell, assume a duplicate
+	return (m_seqMask & (1u << d)) != 0;
+}
+//====================================================================================
+
+void UDPPeer::mark(int32_t seq)
+{
+	int32_t d = seq - m_seqHigh;
+
+	if ((m_seqHigh < 0) || (d > 0) || (d <= -UDP_SEQ_RESTART)) {
+		if ((m_seqHigh >= 0) && (d > 0) && (d < UDP_SEQ_WINDOW)) {
+			m_seqMask = (m_seqMask << d) | 1;
+		} else {
+			m_seqMask = 1;
+		}
+		m_seqHigh = seq;
+		return;
+	}
+	d = -d;
+	if (d < UDP_SEQ_WINDOW) m_seqMask |= (1u << d);  // Late, but not seen yet
+}
+//====================================================================================
+
+void UDPPeer::write(const uint8_t *data, int len)
+{
+	int n;
+
+	if (!m_udp) return;
+	while (len > 0) {
+		if (m_txLen == UDP_TX_BUFFER) flush();
+		n = UDP_TX_BUFFER - m_txLen;
+		if ((m_txLen > 0) && (len <= UDP_TX_BUFFER) && (n < len)) {
+			flush();                           // Keep the message in one datagram
+			continue;
+		}
+		if (n > len) n = len;
+		memcpy(m_tx + m_txLen, data, n);
+		m_txLen += n;
+		data    += n;
+		len     -= n;
+	}
+}
+//====================================================================================
+
+void UDPPeer::flush()
+{
+	if (!m_udp || (m_txLen == 0)) return;
+	m_udp->writeTo(m_tx, m_txLen, IPAddress(m_ip), m_port);
+	m_txDatagrams++;
+	m_txLen = 0;
+}
+//====================================================================================
+
+//====================================================================================
+//=============================-- UDP endpoint --=====================================
+//====================================================================================
+
+UDPCommand::UDPCommand(CommandDB *db, uint16_t port): m_db(db), m_port(port), m_datagrams(0), m_rejected(0)
+{
+	if (m_udp.listen(port)) {
+		m_udp.onPacket([this](AsyncUDPPacket &packet) {
+			onPacket(packet);
+		});
+	}
+}
+//====================================================================================
+
+/*!
+ * \brief Peer of the sender (new slot, or the one idle longer than UDP_PEER_TIMEOUT).
+ */
+UDPPeer *UDPCommand::peer(uint32_t ip, uint16_t port)
+{
+	uint32_t now = millis(), idle, oldest = 0;
+	UDPPeer *p = NULL;
+	int i;
+
+	for (i = 0; i < UDP_MAX_PEERS; ++i) {
+		if (m_peers[i].is(ip, port)) return &m_peers[i];
+	}
+	for (i = 0; i < UDP_MAX_PEERS; ++i) {
+		if (!m_peers[i].active()) {
+			p = &m_peers[i];
+			break;
+		}
+		idle = now - m_peers[i].m_last;
+		if ((idle >= UDP_PEER_TIMEOUT) && (idle >= oldest)) {
+			oldest = idle;
+			p = &m_peers[i];
+		}
+	}
+	if (!p) return NULL;
+	p->detach();
+	p->attach(m_db, &m_udp, ip, port);
+	return p;
+}
+//====================================================================================
+
+void UDPCommand::executeLine(UDPPeer *p, const char *line, int len)
+{
+	int32_t seq = -1;
+	uint32_t rejected;
+	int i;
+
+	/* Same "N<seq> " prefix as CommandDB::executeCommand() */
+	if ((len > 1) && (line[0] == 'N') && (line[1] >= '0') && (line[1] <= '9')) {
+		seq = 0;
+		for (i = 1; (i < len) && (line[i] >= '0') && (line[i] <= '9'); ++i) seq = (seq * 10 + (line[i] - '0')) & 0x7fffffff;
+		if (p->seen(seq)) {
+			p->m_dups++;
+			ResponseWriter(p).printf("ACK,%d,dup\r\n", seq);
+			return;
+		}
+	}
+	rejected = m_db->rejected();
+	p->handleData(line, len);
+	p->handleData("\n", 1);
+	/* Not queued (pool empty) - no ACK, the retransmit is executed */
+	if ((seq < 0) || (m_db->rejected() != rejected)) return;
+	p->mark(seq);
+	ResponseWriter(p).printf("ACK,%d\r\n", seq);
+}
+//====================================================================================
+
+void UDPCommand::onPacket(AsyncUDPPacket &packet)
+{
+	const char *data = (const char *)packet.data();
+	int len = packet.length(), start, i;
+	UDPPeer *p;
+
+	m_datagrams++;
+	p = peer((uint32_t)packet.remoteIP(), packet.remotePort());
+	if (!p) {
+		static const char msg[] = "!8 Err: Too many peers\r\n";
+		m_rejected++;
+		packet.write((const uint8_t *)msg, sizeof(msg) - 1);
+		return;
+	}
+	p->m_last = millis();
+	p->m_datagrams++;
+	p->clearBuffer();                          // A datagram holds whole lines
+	p->m_overflow = false;
+	for (start = i = 0; i <= len; ++i) {
+		if ((i < len) && (data[i] != '\n') && (data[i] != '\r')) continue;
+		if (i > start) executeLine(p, data + start, i - start);
+		start = i + 1;
+	}
+	/* ACKs (and replies of not queued commands) at once */
+	p->flush();
+}
+//====================================================================================
+
+void UDPCommand::loop()
+{
+	int i;
+
+	for (i = 0; i < UDP_MAX_PEERS; ++i) {
+		if (m_peers[i].active()) m_peers[i].flush();
+	}
+}
+//====================================================================================
+
+void UDPCommand::creditTick(int credits)
+{
+	int i;
+
+	for (i = 0; i < UDP_MAX_PEERS; ++i) {
+		if (m_peers[i].active()) m_peers[i].creditTick(credits);
+	}
+}
+//====================================================================================
+
+void UDPCommand::printStat(CommandQueueItem *c)
+{
+	ResponseWriter w(c);
+	int i;
+
+	w.printf("UDP,port=%u,datagrams=%u,rejected=%u\r\n", m_port, m_datagrams, m_rejected);
+	for (i = 0; i < UDP_MAX_PEERS; ++i) {
+		UDPPeer &p = m_peers[i];
+		if (!p.active()) continue;
+		w.printf("UP%d,%s:%u,idle=%ums,seq=%d,datagrams=%u/%u,dups=%u,", i, IPAddress(p.m_ip).toString().c_str(), p.m_port,
+			(uint32_t)(millis() - p.m_last), p.m_seqHigh, p.m_datagrams, p.m_txDatagrams, p.m_dups);
+		p.printLatency(w);
+		w.add("\r\n");
+	}
+	w.ok();
+}
+//====================================================================================
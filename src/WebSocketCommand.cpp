@@ -0,0 +1,183 @@
+/*
+ * WebSocketCommand - Execute commands over a WebSocket (web UI), telemetry push.
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include "WebSocketCommand.h"
+#include "ResponseWriter.h"
+
+//====================================================================================
+//==========================-- WebSocket session --===================================
+//====================================================================================
+
+void WebSocketSession::attach(CommandDB *db, AsyncWebSocketClient *client)
+{
+	m_db       = db;
+	m_client   = client;
+	m_lastSeq  = -1;
+	m_creditInterval = 0;
+	m_creditSent     = -1;
+	m_overflow = false;
+	m_txLen    = 0;
+	resetLatency();
+	clearBuffer();
+}
+//====================================================================================
+
+void WebSocketSession::detach()
+{
+	if (!m_client) return;
+	m_db->detach(this);
+	m_client = NULL;
+}
+//====================================================================================
+
+void WebSocketSession::write(const uint8_t *data, int len)
+{
+	if (!m_client) return;
+	if (len > (WS_TX_BUFFER - m_txLen)) {
+		flush();                           // Make room if the client queue takes it now
+		if (len > (WS_TX_BUFFER - m_txLen)) {
+			m_txDropped += len;
+			return;
+		}
+	}
+	memcpy(m_tx + m_txLen, data, len);
+	m_txLen += len;
+}
+//====================================================================================
+
+void WebSocketSession::flush()
+{
+	if (!m_client || (m_txLen == 0)) return;
+	if (m_client->queueIsFull()) return;   // Slow client, keep collecting
+	m_client->text(m_tx, m_txLen);
+	m_txMessages++;
+	m_txLen = 0;
+}
+//====================================================================================
+
+//====================================================================================
+//==========================-- WebSocket endpoint --==================================
+//====================================================================================
+
+WebSocketCommand::WebSocketCommand(CommandDB *db, AsyncWebServer *server, const char *url): m_db(db), m_interval(WS_TELEMETRY), m_last(0), m_rejected(0)
+{
+	m_ws = new AsyncWebSocket(url);
+	m_ws->onEvent([this](AsyncWebSocket *ws, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+		onEvent(client, type, arg, data, len);
+	});
+	server->addHandler(m_ws);
+}
+//====================================================================================
+
+WebSocketSession *WebSocketCommand::session(AsyncWebSocketClient *client)
+{
+	int i;
+
+	for (i = 0; i < WS_MAX_CLIENTS; ++i) {
+		if (m_sessions[i].m_client == client) return &m_sessions[i];
+	}
+	return NULL;
+}
+//====================================================================================
+
+void WebSocketCommand::onEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)
+{
+	WebSocketSession *s;
+
+	switch (type) {
+		case WS_EVT_CONNECT:
+			cmddebug("WS:New client\n");
+			s = session(NULL);
+			if (!s) {
+				static const char msg[] = "!8 Err: Too many clients\r\n";
+				m_rejected++;
+				client->text(msg, sizeof(msg) - 1);
+				client->close();
+				return;
+			}
+			s->attach(m_db, client);
+			break;
+		case WS_EVT_DISCONNECT:
+			cmddebug("WS:DisConnect\n");
+			s = session(client);
+			if (s) s->detach();
+			break;
+		case WS_EVT_DATA: {
+			AwsFrameInfo *info = (AwsFrameInfo *)arg;
+			s = session(client);
+			if (!s || (info->message_opcode != WS_TEXT)) return;
+			s->handleData((const char *)data, len);
+			/* End of the message ends the line */
+			if (info->final && ((info->index + len) == info->len)) s->handleData("\n", 1);
+			break;
+		}
+		default: break;
+	}
+}
+//====================================================================================
+
+int WebSocketCommand::clients()
+{
+	int i, n = 0;
+
+	for (i = 0; i < WS_MAX_CLIENTS; ++i) if (m_sessions[i].active()) n++;
+	return n;
+}
+//====================================================================================
+
+void WebSocketCommand::loop()
+{
+	uint32_t now = millis();
+	bool due = false;
+	int i;
+
+	if ((now - m_last) >= m_interval) {
+		m_last = now;
+		due    = true;
+		m_ws->cleanupClients(WS_MAX_CLIENTS);
+	}
+	if (m_telemetry && due) {
+		for (i = 0; i < WS_MAX_CLIENTS; ++i) {
+			if (!m_sessions[i].active()) continue;
+			ResponseWriter w(&m_sessions[i]);
+			m_telemetry(w);
+		}
+	}
+	for (i = 0; i < WS_MAX_CLIENTS; ++i) {
+		if (m_sessions[i].active()) m_sessions[i].flush();
+	}
+}
+//====================================================================================
+
+void WebSocketCommand::creditTick(int credits)
+{
+	int i;
+
+	for (i = 0; i < WS_MAX_CLIENTS; ++i) {
+		if (m_sessions[i].active()) m_sessions[i].creditTick(credits);
+	}
+}
+//====================================================================================
+
+void WebSocketCommand::printStat(CommandQueueItem *c)
+{
+	ResponseWriter w(c);
+	int i;
+
+	w.printf("WS,%d/%d,rejected=%u\r\n", clients(), WS_MAX_CLIENTS, m_rejected);
+	for (i = 0; i < WS_MAX_CLIENTS; ++i) {
+		WebSocketSession &s = m_sessions[i];
+		if (!s.active()) continue;
+		w.printf("WC%d,id=%u,pending=%d,messages=%u,dropped=%u,", i, s.m_client->id(), s.m_txLen, s.m_txMessages, s.m_txDropped);
+		s.printLatency(w);
+		w.add("\r\n");
+	}
+	w.ok();
+}
+//====================================================================================
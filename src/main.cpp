@@ -8,13 +8,25 @@ extern "C" {
 #include "Motion1D.h"
 #include "NetworkCommand.h"
 #include "HTTPCommand.h"
+#include "FileCommand.h"
+#include "SerialCommand.h"
+#include "UDPCommand.h"
+#include "EspNowCommand.h"
+#include "WebSocketCommand.h"
 #include "UdpLogger.h"
 #include <string>
 #include "simpleswitch.h"
+#include "TMC2208.h"
+#ifdef MOTION_ND_BENCH
+#include "MotionND.h"
+#endif
 
 /* SWITCHES */
 #define HOSTNAME                 "wire"
 #define NPORT                    (2500)
+#define NCLIENTS                 (2)        /* Concurrent TCP sessions (max NET_MAX_CLIENTS) */
+#define UPORT                    (2501)     /* UDP commands (N<seq> lines, ACK) */
+#define SERIAL_BAUD              (921600)   /* Command UART (wired fallback for TCP), comment out for StepI2S */
 
 // ==-- HW connection --==
 // STEP      - GPIO5  (D1)
@@ -22,6 +34,7 @@ extern "C" {
 // MOTTOR EN - GPIO2  (D4)
 // SERVO     - GPIO12 (D6)
 // BUTTON    - GPIO14 (D5)
+// TMC UART  - GPIO13 (D7) -> PDN_UART (1k resistor)
 //========================
 
 // PIN definition
@@ -30,6 +43,11 @@ extern "C" {
 #define enableMotor  2
 #define servoPin     12
 #define pushButton   14
+#define tmcUart      13
+
+#define TMC_BAUD     (115200)
+// Longest cut [um]: the move time at 50 mm/s has to fit the 16-bit duration [ms]
+#define CUT_LENGTH_MAX (65535000 / 20)
 
 #ifdef DEBUG_ENABLED
 UdpLoggerClass     UdpLogger;
@@ -50,15 +68,37 @@ Motion1D          *m1d;
 CommandDB         CmdDB;
 NetworkCommand    *NCmd;
 HTTPCommand       *HCmd;
+FileCommand       *FCmd;
+#ifdef SERIAL_BAUD
+SerialCommand     *SCmd;
+/* StepI2S clocks STEP out of GPIO3, the RX pin of the command UART */
+static_assert(!std::is_same<MotionBackend, StepI2S>::value, "StepI2S and SerialCommand both use GPIO3 (UART0 RX), comment out SERIAL_BAUD");
+#endif
+UDPCommand        *UCmd;
+EspNowRadio       espNowRadio;
+EspNowCommand     *ECmd;
+WebSocketCommand  *WCmd;
+SoftwareSerial    tmcSerial(tmcUart, tmcUart);
+TMC2208SoftUart   tmcPort(&tmcSerial);
+TMC2208           tmc(&tmcPort);
 volatile int ota_in_progress  = 0;
 static int current_microsteps = 16;
+static int cruise_microsteps  = 16;    /* Adaptive microstepping at cruise speed (off, MS,<cruise> enables) */
+static bool tmc_ok            = false;
 const  int steps_per_rev      = 200; 
 const  int steps_per_mm       = 99; //104;
 volatile int catCounter       = 0;
 volatile int catDistance      = 0;
 volatile int catDuration      = 0;
+static int32_t cutList[COMMAND_MAX_ARGS];  /* Cut list lengths [microsteps] */
+static int cutListLen         = 0;
+static int cutListPos         = 0;
+static int cutListRepeat      = 0;
 
 static void makeCmdInterface();
+static int motionCredits();
+static void motionFault(const char *reason);
+static bool tmcSetMicrosteps(int microsteps) {return tmc.setMicrosteps(microsteps);}
 
 /*!
  * \brief Setup.
@@ -72,7 +112,6 @@ static void makeCmdInterface();
 void setup()
 {
 	/* Setup pins */
-	Serial.begin(115200);
 	pinMode(enableMotor, OUTPUT);
 	pinMode(step1, OUTPUT);
 	pinMode(dir1, OUTPUT);
@@ -94,10 +133,16 @@ void setup()
 	ArduinoOTA.begin();
 	
 	makeCmdInterface();
+
+	/* Configure TMC2208 */
+	tmcSerial.begin(TMC_BAUD);
+	tmc_ok = tmc.begin(current_microsteps);
+	pdebug("TMC2208 %s\n", tmc_ok ? "configured" : "not responding (using MS pins)");
 	
 	/* Setup driver */
 	digitalWrite(enableMotor, LOW);    // Enable driver in hardware
-	m1d = new Motion1D(step1, dir1, enableMotor, servoPin);
+	m1d = new Motion1DPins<step1, dir1>(enableMotor, servoPin);
+	if (tmc_ok) m1d->adaptiveMicrosteps(current_microsteps, cruise_microsteps, tmcSetMicrosteps);
 
 	new SimpleSwitch(14, [](SimpleSwitch *s, int butonEvent) { if (butonEvent) m1d->setCutterDown(); else m1d->setCutterUp(); } );
 
@@ -118,7 +163,10 @@ void loop()
 	if (ota_in_progress) return;
 
 	/* Execute command from queue */
-	if ( m1d->loop() ) {
+	bool full = m1d->loop();
+	const char *fault = m1d->fault();
+	if (fault) motionFault(fault);
+	if ( full ) {
 		CmdDB.loop();
 	} else {
 		if (m1d->motionQ_is_empty()) {
@@ -128,11 +176,41 @@ void loop()
 				m1d->goTo(catDuration, catDistance);
 				m1d->setCutterDown(1500);
 				m1d->setCutterUp(800);
+			} else if (cutListRepeat) {
+				/* Queue next cut from the cut list (50mm/s) */
+				m1d->goTo((cutList[cutListPos] * 20) / steps_per_mm, cutList[cutListPos]);
+				m1d->setCutterDown(1500);
+				m1d->setCutterUp(800);
+				if (++cutListPos == cutListLen) {
+					cutListPos = 0;
+					cutListRepeat--;
+				}
 			}
 		}
 		CmdDB.loopMotion();
 		CmdDB.loop();
 	}
+	/* Credit reports (CRD) */
+	int credits = motionCredits();
+	NCmd->creditTick(credits);
+	HCmd->creditTick(credits);
+#ifdef SERIAL_BAUD
+	SCmd->creditTick(credits);
+#endif
+	UCmd->creditTick(credits);
+	WCmd->creditTick(credits);
+	/* Script job (RUN) */
+	FCmd->feed(credits);
+	/* Coalesced TCP output */
+	NCmd->loop();
+#ifdef SERIAL_BAUD
+	/* UART input and output */
+	SCmd->loop();
+#endif
+	/* Replies of queued UDP commands */
+	UCmd->loop();
+	/* WebSocket output and telemetry */
+	WCmd->loop();
 }
 //====================================================================================
 
@@ -146,9 +224,9 @@ static int g_pos_x = 0;
  */
 static void stepperMoveAbsoluteRev(CommandQueueItem *c)
 {
-	int d        = c->m_arg0;
-	int newS     = c->m_arg1;
-	int newE     = c->m_arg2;
+	int d        = c->m_arg[0];
+	int newS     = c->m_arg[1];
+	int newE     = c->m_arg[2];
 	int duration, aX, dX;
 	int speed    = 6000;
 
@@ -190,8 +268,8 @@ static void stepperMoveAbsoluteRev(CommandQueueItem *c)
  */
 static void stepperMoveRelativeRev(CommandQueueItem *c)
 {
-	int d        = c->m_arg0;
-	int newS     = g_pos_x + (c->m_arg1 * steps_per_rev * current_microsteps);
+	int d        = c->m_arg[0];
+	int newS     = g_pos_x + (c->m_arg[1] * steps_per_rev * current_microsteps);
 	int aX, dX;
 
 	if ((c->m_arg_mask & 3) != 3) {
@@ -213,9 +291,9 @@ static void stepperMoveRelativeRev(CommandQueueItem *c)
  */
 static void stepperMoveAbsolute(CommandQueueItem *c)
 {
-	int d        = c->m_arg0;
-	int newS     = c->m_arg1;
-	int newE     = c->m_arg2;
+	int d        = c->m_arg[0];
+	int newS     = c->m_arg[1];
+	int newE     = c->m_arg[2];
 	int duration, aX, dX;
 	int speed    = 3000;
 
@@ -249,8 +327,8 @@ static void stepperMoveAbsolute(CommandQueueItem *c)
  */
 static void stepperMoveRelative(CommandQueueItem *c)
 {
-	int d        = c->m_arg0;
-	int newS     = g_pos_x + c->m_arg1;
+	int d        = c->m_arg[0];
+	int newS     = g_pos_x + c->m_arg[1];
 	int aX, dX;
 
 	if ((c->m_arg_mask & 3) != 3) {
@@ -273,8 +351,8 @@ static void stepperMoveRelative(CommandQueueItem *c)
  */
 static void stepperMoveUncondicional(CommandQueueItem *c)
 {
-	int d        = c->m_arg0;
-	int newS     = g_pos_x + c->m_arg1;
+	int d        = c->m_arg[0];
+	int newS     = g_pos_x + c->m_arg[1];
 	int aX, dX;
 
 	if ((c->m_arg_mask & 3) != 3) {
@@ -294,11 +372,36 @@ static void stepperMoveUncondicional(CommandQueueItem *c)
 /*!
  * \brief STOP movement.
  */
-static void stepperMoveStop(CommandQueueItem *c)
+static void stopAll()
 {
+	motion_snapshot_t st;
+
 	m1d->stop();
-	g_pos_x = x_pos;
+	/* A stop ends a feed hold too, the next commands start without '~' */
+	m1d->hold(false);
+	/* The axis settles on the target set by stop() */
+	m1d->snapshot(&st);
+	g_pos_x = st.target;
 	catCounter = 0;
+	cutListRepeat = 0;
+	FCmd->abort("stopped");
+}
+
+/*!
+ * \brief Motion stopped by a fault (queue already flushed): stop the jobs and tell the owner.
+ */
+static void motionFault(const char *reason)
+{
+	Command *owner = CmdDB.motionOwner();
+
+	stopAll();
+	CmdDB.cancelMotion(reason);
+	if (owner) ResponseWriter(owner).error(reason);
+}
+
+static void stepperMoveStop(CommandQueueItem *c)
+{
+	stopAll();
 	c->sendAck();
 }
 //====================================================================================
@@ -310,8 +413,7 @@ void cmdG90(CommandQueueItem *c)
 {
 	m1d->stop();
 	g_pos_x  = 0;
-	x_pos    = 0;
-	x_target = 0;
+	m1d->setZero();
 	c->sendAck();
 }
 //====================================================================================
@@ -345,8 +447,8 @@ static void enableMotors(CommandQueueItem *c)
 {
 	int value = -1, cmd = -1;
 
-	if (c->m_arg_mask & 1) cmd = c->m_arg0;
-	if (c->m_arg_mask & 2) value = c->m_arg1;
+	if (c->m_arg_mask & 1) cmd = c->m_arg[0];
+	if (c->m_arg_mask & 2) value = c->m_arg[1];
 
 	if ((cmd != -1) && (value == -1)) {
 		switch (cmd) {
@@ -365,64 +467,428 @@ static void enableMotors(CommandQueueItem *c)
 }
 //====================================================================================
 
-static void unrecognized(const char *command, Command *c) {c->print("!8 Err: Unknown command\r\n");}
+/*!
+ * \brief Adaptive microstepping (MS - print, MS,cruise - set cruise microsteps, 0 - off).
+ */
+static void cmdMicrosteps(CommandQueueItem *c)
+{
+	if (c->m_arg_mask & 1) {
+		int cruise = c->m_arg[0] ? c->m_arg[0] : current_microsteps;
+		if (!tmc_ok || !m1d->adaptiveMicrosteps(current_microsteps, cruise, tmcSetMicrosteps)) {
+			c->sendErrorText("Driver busy or invalid resolution");
+			return;
+		}
+		cruise_microsteps = cruise;
+		c->sendAck();
+	} else {
+		ResponseWriter(c).printf("MS,%d,%d%s\r\nOK\r\n", current_microsteps, cruise_microsteps, tmc_ok ? "" : ",no uart");
+	}
+}
+//====================================================================================
 
+#ifdef MOTION_ND_BENCH
 /*!
- * \brief Fill commands database.
+ * \brief Multi axis ISR cost (BMN) - MotionND<1..3> without pin output, one line per axis count.
  */
-static void makeCmdInterface()
+static void cmdBenchND(CommandQueueItem *c)
+{
+	motion_snapshot_t st;
+	auto out = [c](String s) {c->print(s);};
+
+	m1d->snapshot(&st);
+	if (st.in_motion || st.queue) {
+		c->sendErrorText("Motion in progress");
+		return;
+	}
+	{MotionND<1> m(NULL, NULL, -1); m.bench(out);}
+	{MotionND<2> m(NULL, NULL, -1); m.bench(out);}
+	{MotionND<3> m(NULL, NULL, -1); m.bench(out);}
+	c->sendAck();
+}
+//====================================================================================
+#endif
+
+/*!
+ * \brief Cut list (CL,count,len1[,len2,...]) - cut the listed lengths [mm, e.g. 12.5, max 3276.75] count times.
+ */
+static bool setCutList(int count, const int32_t *um, int n)
+{
+	int i;
+
+	if ((count < 0) || (n < 1) || (n > COMMAND_MAX_ARGS)) return false;
+	for (i = 0; i < n; ++i) {
+		if ((um[i] <= 0) || (um[i] > CUT_LENGTH_MAX)) return false;
+	}
+	for (i = 0; i < n; ++i) cutList[i] = (int32_t)(((int64_t)um[i] * steps_per_mm) / 1000);
+	cutListLen    = n;
+	cutListPos    = 0;
+	cutListRepeat = count;
+	return true;
+}
+
+static void cmdCutList(CommandQueueItem *c)
+{
+	int32_t um[COMMAND_MAX_ARGS];
+	int i;
+
+	if (c->m_argc < 2) {
+		c->sendErrorText("Missing argument");
+		return;
+	}
+	for (i = 1; i < c->m_argc; ++i) {
+		int64_t v = c->argMilli(i);
+		if ((v <= 0) || (v > CUT_LENGTH_MAX)) {
+			c->sendErrorText("Bad length");
+			return;
+		}
+		um[i - 1] = (int32_t)v;
+	}
+	if (!setCutList(c->m_arg[0], um, c->m_argc - 1)) {
+		c->sendErrorText("Bad length");
+		return;
+	}
+	CmdDB.setMotionOwner(c->m_parent);
+	c->sendAck();
+}
+//====================================================================================
+
+/*!
+ * \brief Binary move segments, straight into the motion queue (see BinaryFrame.h).
+ * Accepted only when no text motion command is waiting (keeps the order).
+ */
+static int binMove(Command *c, const uint8_t *in, int len, uint8_t *out, int *outLen)
+{
+	int n = len / 6, i, accepted = 0;
+
+	if ((len == 0) || (len % 6)) return BIN_BAD_LENGTH;
+	if (CmdDB.isMotinQueueEmpty()) {
+		CmdDB.setMotionOwner(c);
+		int space = m1d->motionQ_free();
+		for (i = 0; (i < n) && (accepted < space); ++i, in += 6) {
+			int32_t dx = (int32_t)bin_get_u32(in + 2);
+			if (dx) m1d->goTo(bin_get_u16(in), dx);
+			g_pos_x += dx;
+			accepted++;
+		}
+	}
+	out[0]  = accepted;
+	*outLen = 1;
+	return (accepted == n) ? BIN_OK : BIN_BUSY;
+}
+
+static int binCutList(Command *c, const uint8_t *in, int len, uint8_t *out, int *outLen)
+{
+	int32_t um[COMMAND_MAX_ARGS];
+	int i, n = (len - 2) / 4;
+
+	if ((len < 6) || ((len - 2) % 4) || (n > COMMAND_MAX_ARGS)) return BIN_BAD_LENGTH;
+	for (i = 0; i < n; ++i) um[i] = (int32_t)bin_get_u32(in + 2 + 4 * i);
+	if (!setCutList(bin_get_u16(in), um, n)) return BIN_BAD_VALUE;
+	CmdDB.setMotionOwner(c);
+	return BIN_OK;
+}
+
+static int binStatus(Command *c, const uint8_t *in, int len, uint8_t *out, int *outLen)
+{
+	motion_snapshot_t st;
+
+	m1d->snapshot(&st);
+	bin_put_u32(out, st.pos);
+	bin_put_u32(out + 4, st.target);
+	out[8]  = st.queue;
+	out[9]  = m1d->motionQ_free();
+	*outLen = 10;
+	return BIN_OK;
+}
+//====================================================================================
+
+/*!
+ * \brief Motion commands a client can send now (a move takes up to two motion queue entries).
+ */
+static int motionCredits()
+{
+	return CmdDB.credits(m1d->motionQ_free() / 2);
+}
+
+/*!
+ * \brief Credit reports (CRD - report now, CRD,ms - report every ms and on change, CRD,0 - off).
+ */
+static void cmdCredits(CommandQueueItem *c)
+{
+	if (c->m_arg_mask & 1) {
+		if (c->m_arg[0] < 0) {
+			c->sendError();
+			return;
+		}
+		c->m_parent->m_creditInterval = c->m_arg[0];
+		c->sendAck();
+	}
+	c->m_parent->creditTick(motionCredits(), true);
+}
+//====================================================================================
+
+/*!
+ * \brief TCP sessions (NC - report with transmit counters, NC,n - set client limit).
+ */
+static void cmdNetClients(CommandQueueItem *c)
+{
+	if (c->m_arg_mask & 1) {
+		if (!NCmd->setMaxClients(c->m_arg[0])) {
+			c->sendErrorText("Client limit out of range");
+			return;
+		}
+	}
+	NCmd->printStat(c);
+}
+//====================================================================================
+
+/*!
+ * \brief Feed rate override (FO - report, FO,percent - set, 10..200).
+ */
+static void cmdFeedOverride(CommandQueueItem *c)
+{
+	if ((c->m_arg_mask & 1) && !m1d->feedOverride(c->m_arg[0])) {
+		c->sendErrorText("Feed override out of range or not supported");
+		return;
+	}
+	ResponseWriter(c).printf("FO,%d\r\nOK\r\n", m1d->feed());
+}
+//====================================================================================
+
+/*!
+ * \brief Status line ('?' real-time command, WebSocket telemetry).
+ */
+static void printStatus(ResponseWriter &w)
+{
+	motion_snapshot_t st;
+
+	m1d->snapshot(&st);
+	w.printf("<%s,pos=%d,target=%d,queue=%d,cut=%d,feed=%d>\r\n", m1d->held() ? "Hold" : (st.active ? "Run" : "Idle"),
+		st.pos, st.target, st.queue, catCounter, m1d->feed());
+}
+//====================================================================================
+
+/*!
+ * \brief Real-time commands (called from the receive callback, see RT_* in Command.h).
+ */
+static void realtimeCommand(Command *c, uint8_t rt)
+{
+	switch (rt) {
+		case RT_STOP:
+			stopAll();
+			CmdDB.cancelMotion("Stopped");
+			c->print("STOP\r\n");
+			break;
+		case RT_HOLD:
+			m1d->hold(true);
+			break;
+		case RT_RESUME:
+			m1d->hold(false);
+			break;
+		case RT_STATUS: {
+			ResponseWriter w(c);
+			printStatus(w);
+			break;
+		}
+		default: break;
+	}
+}
+//====================================================================================
+
+/*!
+ * \brief Script job (RUN,name - start, RUN - status), executed on reception.
+ */
+static void cmdRun(Command *c, int32_t seq, const char *args)
 {
-	CmdDB.addCommand("v",[](CommandQueueItem *c) {
+	ResponseWriter w(c, seq);
+	const char *err;
+
+	if (!args) {
+		FCmd->printStat(w);
+		w.ok();
+		return;
+	}
+	err = FCmd->start(c, args);
+	if (err) {
+		w.error(err);
+	} else {
+		w.ok();
+	}
+}
+//====================================================================================
+
+static void unrecognized(const char *command, Command *c) {c->print("!8 Err: Unknown command\r\n");}
+
+/*!
+ * \brief Built-in commands (perfect hash table built by the compiler).
+ */
+static constexpr CommandTableEntry builtinCommands[] = {
+	{"v",[](CommandQueueItem *c) {
 		c->print("WireCutter-Firmware V1.0\r\n");
-	});
-	CmdDB.addCommand("EM" ,enableMotors);
+	}, false},
+	{"EM" ,enableMotors, false},
 	/* Motion commands */
-	CmdDB.addCommand("M"  ,stepperMoveAbsoluteRev, true);
-	CmdDB.addCommand("MR" ,stepperMoveRelativeRev, true);
-	CmdDB.addCommand("MH", cmdHome, true);
-	CmdDB.addCommand("GT" ,stepperMoveAbsolute, true);
-	CmdDB.addCommand("GTR",stepperMoveRelative, true);
-	CmdDB.addCommand("GTH",cmdHome, true);
-	CmdDB.addCommand("UM" ,stepperMoveUncondicional, true);
-	CmdDB.addCommand("STP",stepperMoveStop);
-	CmdDB.addCommand("TC",[](CommandQueueItem *c) { 
+	{"M"  ,stepperMoveAbsoluteRev, true},
+	{"MR" ,stepperMoveRelativeRev, true},
+	{"MH", cmdHome, true},
+	{"GT" ,stepperMoveAbsolute, true},
+	{"GTR",stepperMoveRelative, true},
+	{"GTH",cmdHome, true},
+	{"UM" ,stepperMoveUncondicional, true},
+	{"STP",stepperMoveStop, false},
+	{"FO" ,cmdFeedOverride, false},
+	{"TC",[](CommandQueueItem *c) { 
 		m1d->toggleCutter();
 		c->sendAck(); 
-	});
-	CmdDB.addCommand("CU",[](CommandQueueItem *c) { 
+	}, false},
+	{"CU",[](CommandQueueItem *c) { 
 		m1d->setCutterUp();
 		c->sendAck(); 
-	});
-	CmdDB.addCommand("CD",[](CommandQueueItem *c) { 
+	}, false},
+	{"CD",[](CommandQueueItem *c) { 
 		m1d->setCutterDown();
 		c->sendAck(); 
-	});
-	CmdDB.addCommand("CT",[](CommandQueueItem *c) { 
+	}, false},
+	{"CT",[](CommandQueueItem *c) { 
 		m1d->setCutterDown(1500);
 		m1d->setCutterUp(1500);
 		c->sendAck(); 
-	});
+	}, false},
 
-	CmdDB.addCommand("CUT",[](CommandQueueItem *c) { 
-		catCounter = c->m_arg0;
-		catDistance = c->m_arg1; 
-		catDuration = c->m_arg2; 
+	{"CUT",[](CommandQueueItem *c) { 
+		if ((c->m_arg_mask & 7) != 7) {
+			c->sendErrorText("Missing argument");
+			return;
+		}
+		catCounter = c->m_arg[0];
+		catDistance = c->m_arg[1]; 
+		catDuration = c->m_arg[2]; 
+		CmdDB.setMotionOwner(c->m_parent);
 		c->sendAck(); 
-	});
-	CmdDB.addCommand("CUTD",[](CommandQueueItem *c) { 
-		catCounter = c->m_arg0;
-		catDistance = c->m_arg1 * steps_per_mm ; /* Convert milimeters to microsteps */
-		catDuration = c->m_arg1 * 20;            /* Set Duration 50mm/s */ 
-		pdebug(("Cut wires " +String(catCounter) + ", "+String(c->m_arg1) + "[mm], "+String(catDistance) + "[usteps], " + String(catDuration)+ "[ms]\n\r").c_str() );
+	}, false},
+	{"CUTD",[](CommandQueueItem *c) { 
+		if ((c->m_arg_mask & 3) != 3) {
+			c->sendErrorText("Missing argument");
+			return;
+		}
+		int64_t um = c->argMilli(1);
+		if ((um <= 0) || (um > CUT_LENGTH_MAX)) {
+			c->sendErrorText("Bad length");
+			return;
+		}
+		catCounter = c->m_arg[0];
+		catDistance = (um * steps_per_mm) / 1000; /* Convert milimeters to microsteps */
+		catDuration = um / 50;                     /* Set Duration 50mm/s */ 
+		pdebug(("Cut wires " +String(catCounter) + ", "+String(c->m_arg[1]) + "[mm], "+String(catDistance) + "[usteps], " + String(catDuration)+ "[ms]\n\r").c_str() );
+		CmdDB.setMotionOwner(c->m_parent);
 		c->sendAck(); 
-	});
+	}, false},
+	{"CL" ,cmdCutList, false},
 	/* Parameters */
-	CmdDB.addCommand("G90",cmdG90, true);
+	{"G90",cmdG90, true},
+	{"MS" ,cmdMicrosteps, true},
 	/* Status */
-	CmdDB.addCommand("XX" ,[](CommandQueueItem *c){ m1d->printStat(c); });
+	{"XX" ,[](CommandQueueItem *c){ m1d->printStat(c); }, false},
+	/* Step backend benchmark (BM - active backend, BM,1 - simulated backend) */
+	{"BM" ,[](CommandQueueItem *c){ m1d->bench(c, (c->m_arg_mask & 1) && (c->m_arg[0] == 1)); }, false},
+#ifdef MOTION_ND_BENCH
+	{"BMN",cmdBenchND, false},
+#endif
+	/* Flow control: credit reports for this connection */
+	{"CRD",cmdCredits, false},
+	/* TCP sessions */
+	{"NC" ,cmdNetClients, false},
+#ifdef SERIAL_BAUD
+	/* Command UART (SER - port counters, latency vs TCP in NC) */
+	{"SER",[](CommandQueueItem *c){ ResponseWriter w(c); SCmd->printStat(w); w.ok(); }, false},
+#endif
+	/* UDP endpoint and peers */
+	{"UDP",[](CommandQueueItem *c){ UCmd->printStat(c); }, false},
+	/* ESP-NOW pendant (EN - peers, EN,seconds - pairing window, EN,0 - forget them) */
+	{"EN" ,[](CommandQueueItem *c){
+		if (c->m_arg_mask & 1) {
+			if (c->m_arg[0] == 0) {
+				ECmd->unpair();
+			} else if ((c->m_arg[0] < 0) || !ECmd->pair(c->m_arg[0])) {
+				c->sendErrorText("Pairing time out of range");
+				return;
+			}
+		}
+		ECmd->printStat(c);
+	}, false},
+	/* WebSocket clients */
+	{"WS" ,[](CommandQueueItem *c){ WCmd->printStat(c); }, false},
+	/* Macros (DEF,name ... END, see CommandMacro.h) */
+	{"MAC",[](CommandQueueItem *c){ CmdDB.printMacros(c); }, false},
+	/* Scripts on LittleFS (RUN,name and RM,name are text commands) */
+	{"RUNX",[](CommandQueueItem *c){ FCmd->abort("aborted"); c->sendAck(); }, false},
+	{"LS" ,[](CommandQueueItem *c){ ResponseWriter w(c); FCmd->list(w); w.ok(); }, false},
+	/* Command latency per stage (LAT - report, LAT,0 - reset) */
+	{"LAT",[](CommandQueueItem *c){
+#ifdef LATENCY_TRACE
+		if (c->m_arg_mask & 1) {
+			latencyTrace.reset();
+			c->sendAck();
+			return;
+		}
+		ResponseWriter w(c);
+		latencyTrace.print(w);
+		w.ok();
+#else
+		c->sendErrorText("Latency trace disabled");
+#endif
+	}, false},
+	/* Real-time command latency */
+	{"RT" ,[](CommandQueueItem *c){ CmdDB.printRealtime(c); }, false},
+	/* Switch this connection to binary frames (after OK, see BinaryFrame.h) */
+	{"BIN",[](CommandQueueItem *c){
+		if (!c->m_parent->m_binaryCapable) {
+			c->sendErrorText("Not supported");
+			return;
+		}
+		c->sendAck();
+		c->m_parent->setBinaryMode(true);
+	}, false},
+	/* Command lookup benchmark (std::map vs built-in table) */
+	{"LB" ,[](CommandQueueItem *c){ CmdDB.benchLookup(c); }, false},
+	/* Handler dispatch cost (std::function vs Delegate) */
+	{"DC" ,[](CommandQueueItem *c){ CmdDB.benchDispatch(c); }, false},
+	/* Command pool and lookup counters */
+	{"QS" ,[](CommandQueueItem *c){ CmdDB.printStat(c); }, false},
+};
+COMMAND_TABLE(builtinTable, builtinCommands);
+
+/*!
+ * \brief Fill commands database.
+ */
+static void makeCmdInterface()
+{
+	CmdDB.setTable(builtinTable.view());
+	CmdDB.addBinary(BIN_OP_MOVE, binMove);
+	CmdDB.addBinary(BIN_OP_CUT_LIST, binCutList);
+	CmdDB.addBinary(BIN_OP_STOP, [](Command *c, const uint8_t *in, int len, uint8_t *out, int *outLen) { stopAll(); return BIN_OK; });
+	CmdDB.addBinary(BIN_OP_STATUS, binStatus);
 	CmdDB.setDefaultHandler(unrecognized); // Handler for command that isn't matched (says "What?")
+	CmdDB.setRealtime(realtimeCommand);    // Stop, feed hold, resume and status bytes
+	CmdDB.setDetachHandler([](Command *c) { if (FCmd) FCmd->detach(c); });   // Job owner disconnected
+	CmdDB.addTextCommand("RUN", cmdRun);
+	CmdDB.addTextCommand("RM", [](Command *c, int32_t seq, const char *args) {
+		if (FCmd->remove(args)) ResponseWriter(c, seq).ok(); else ResponseWriter(c, seq).error("Can not remove");
+	});
 
-	NCmd = new NetworkCommand(&CmdDB, NPORT);
+	FCmd = new FileCommand(&CmdDB);
+	FCmd->begin();
+
+#ifdef SERIAL_BAUD
+	SCmd = new SerialCommand(&CmdDB);
+	SCmd->begin(SERIAL_BAUD);
+#endif
+	NCmd = new NetworkCommand(&CmdDB, NPORT, NCLIENTS);
+	UCmd = new UDPCommand(&CmdDB, UPORT);
+	ECmd = new EspNowCommand(&CmdDB, &espNowRadio);
+	ECmd->begin();
 	HCmd = new HTTPCommand(&CmdDB);
+	WCmd = new WebSocketCommand(&CmdDB, HCmd->m_server);
+	WCmd->setTelemetry(printStatus);       // Status line (same as '?') instead of /cnt polling
 }
 //====================================================================================
@@ -29,7 +29,7 @@ void ICACHE_RAM_ATTR SimpleSwitch::onChange(void)
 	m_lastDebounceTime = mark;
 	m_state = btn;
 	if (m_holdDetect) {
-		if (btn) m_ticker.attach_ms(m_holdDetect, [this]() ICACHE_RAM_ATTR { onHold();} ); else m_ticker.detach();
+		if (btn) m_ticker.attach_ms(m_holdDetect, onHoldCB, this); else m_ticker.detach();
 	}
 	if (m_CB) m_CB(this, m_state);
 }
@@ -44,7 +44,7 @@ void SimpleSwitch::onHold(void)
 
 	key = gpio_r->in;
 	if ((key & m_gpioPinMask) == 0) {
-		if (m_holdDetect2) m_ticker.attach_ms(m_holdDetect2, [this]() ICACHE_RAM_ATTR { onHold2();} );
+		if (m_holdDetect2) m_ticker.attach_ms(m_holdDetect2, onHold2CB, this);
 		m_CB(this, 2);
 	} else {
 		if (m_state) {
@@ -0,0 +1,62 @@
+/*
+ * Host build of the Arduino parts used by the command layer (native tests only).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __NATIVE_ARDUINO_H__
+#define __NATIVE_ARDUINO_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string>
+
+typedef bool boolean;
+
+/*!
+ * \brief String with the members the command layer uses.
+ */
+class String {
+public:
+	String(const char *s = "") : m_s(s ? s : "") {}
+	String(int v) : m_s(std::to_string(v)) {}
+	String(unsigned int v) : m_s(std::to_string(v)) {}
+	String(long v) : m_s(std::to_string(v)) {}
+	String(unsigned long v) : m_s(std::to_string(v)) {}
+	const char *c_str() const {return m_s.c_str();}
+	unsigned int length() const {return m_s.size();}
+	String operator+(const String &o) const {String r(*this); r.m_s += o.m_s; return r;}
+	String &operator+=(const String &o) {m_s += o.m_s; return *this;}
+	bool operator<(const String &o) const {return m_s < o.m_s;}
+	bool operator==(const String &o) const {return m_s == o.m_s;}
+public:
+	std::string m_s;
+};
+
+inline String operator+(const char *a, const String &b) {return String(a) + b;}
+
+/*!
+ * \brief Time runs only when a test moves it (nativeTime).
+ */
+inline uint32_t nativeTime = 0;
+
+inline unsigned long millis() {return nativeTime;}
+inline unsigned long micros() {return nativeTime * 1000;}
+inline void yield() {}
+
+class EspClass {
+public:
+	uint32_t getCycleCount() {return nativeTime * 80000;}
+	uint8_t  getCpuFreqMHz() {return 80;}
+	uint32_t getFreeHeap()   {return 0;}
+};
+
+inline EspClass ESP;
+
+#endif // __NATIVE_ARDUINO_H__
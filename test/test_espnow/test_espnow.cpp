@@ -0,0 +1,191 @@
+/*
+ * Host test: ESP-NOW commands over the loopback link (pio test -e native).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include <unity.h>
+#include "EspNowCommand.h"
+
+static const uint8_t macCtrl[ESPNOW_MAC_LEN]    = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t macPendant[ESPNOW_MAC_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+static const uint8_t macOther[ESPNOW_MAC_LEN]   = {0x02, 0x00, 0x00, 0x00, 0x00, 0x03};
+
+/* Last reply seen by the pendant */
+static uint8_t  reply[ESPNOW_MAX_DATA];
+static int      replyLen;
+static int      replies;
+static int      moves;
+
+static CommandDB      *db;
+static EspNowLoopback *ctrl, *pendant, *other;
+static EspNowCommand  *en;
+
+static int binMove(Command *c, const uint8_t *in, int len, uint8_t *out, int *outLen)
+{
+	moves++;
+	out[0]  = 1;
+	*outLen = 1;
+	return BIN_OK;
+}
+
+static void cmdPing(CommandQueueItem *c)
+{
+	c->sendAck();
+}
+
+static void onReply(const uint8_t *mac, const uint8_t *data, int len)
+{
+	memcpy(reply, data, len);
+	replyLen = len;
+	replies++;
+}
+
+void setUp()
+{
+	nativeTime = 1000;
+	replyLen   = replies = moves = 0;
+	db      = new CommandDB();
+	db->addCommand("P", cmdPing);
+	db->addBinary(BIN_OP_MOVE, binMove);
+	ctrl    = new EspNowLoopback(macCtrl);
+	pendant = new EspNowLoopback(macPendant);
+	other   = new EspNowLoopback(macOther);
+	ctrl->connect(pendant);
+	pendant->onReceive(onReply);
+	en      = new EspNowCommand(db, ctrl);
+	en->begin();
+}
+
+void tearDown()
+{
+	delete en;
+	delete other;
+	delete pendant;
+	delete ctrl;
+	delete db;
+}
+//====================================================================================
+
+/*!
+ * \brief Binary command and its reply: [seq][op | BIN_REPLY][status][data].
+ */
+static void test_command_reply()
+{
+	const uint8_t move[] = {7, BIN_OP_MOVE, 0x64, 0x00, 0x20, 0x03, 0x00, 0x00};
+	const uint8_t expected[] = {7, BIN_OP_MOVE | BIN_REPLY, BIN_OK, 1};
+
+	TEST_ASSERT_TRUE(en->pair(10));
+	TEST_ASSERT_TRUE(pendant->send(macCtrl, move, sizeof(move)));
+	TEST_ASSERT_EQUAL_INT(1, moves);
+	TEST_ASSERT_EQUAL_INT(sizeof(expected), replyLen);
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, reply, sizeof(expected));
+}
+//====================================================================================
+
+/*!
+ * \brief A resent request is not executed again, its reply is repeated.
+ */
+static void test_duplicate()
+{
+	const uint8_t move[] = {9, BIN_OP_MOVE, 0x64, 0x00, 0x01, 0x00, 0x00, 0x00};
+
+	en->pair(10);
+	pendant->send(macCtrl, move, sizeof(move));
+	pendant->send(macCtrl, move, sizeof(move));
+	TEST_ASSERT_EQUAL_INT(1, moves);
+	TEST_ASSERT_EQUAL_INT(2, replies);
+	TEST_ASSERT_EQUAL_UINT8(9, reply[0]);
+	TEST_ASSERT_EQUAL_UINT32(1, en->m_peers[0].m_dups);
+}
+//====================================================================================
+
+/*!
+ * \brief Text command: queued, its reply comes as a BIN_OP_TEXT frame when it runs.
+ */
+static void test_text_command()
+{
+	const uint8_t ping[] = {3, BIN_OP_PING};
+	const uint8_t text[] = {4, BIN_OP_TEXT, 'N', '5', ' ', 'P'};
+
+	en->pair(10);
+	pendant->send(macCtrl, ping, sizeof(ping));
+	TEST_ASSERT_EQUAL_INT(4, replyLen);
+	TEST_ASSERT_EQUAL_UINT8(BIN_OP_PING | BIN_REPLY, reply[1]);
+	TEST_ASSERT_EQUAL_UINT8(BIN_VERSION, reply[3]);
+	pendant->send(macCtrl, text, sizeof(text));
+	TEST_ASSERT_EQUAL_INT(1, replies);
+	db->loop();
+	TEST_ASSERT_EQUAL_INT(2, replies);
+	TEST_ASSERT_EQUAL_UINT8(BIN_OP_TEXT | BIN_REPLY, reply[1]);
+	TEST_ASSERT_EQUAL_INT(ESPNOW_HEADER + 7, replyLen);
+	TEST_ASSERT_EQUAL_MEMORY("N5 OK\r\n", reply + ESPNOW_HEADER, 7);
+}
+//====================================================================================
+
+/*!
+ * \brief Unknown opcode gets BIN_UNKNOWN.
+ */
+static void test_unknown_opcode()
+{
+	const uint8_t msg[] = {5, 0x1f};
+
+	en->pair(10);
+	pendant->send(macCtrl, msg, sizeof(msg));
+	TEST_ASSERT_EQUAL_INT(3, replyLen);
+	TEST_ASSERT_EQUAL_UINT8(0x1f | BIN_REPLY, reply[1]);
+	TEST_ASSERT_EQUAL_UINT8(BIN_UNKNOWN, reply[2]);
+}
+//====================================================================================
+
+/*!
+ * \brief Senders are paired only while the window is open, others are dropped.
+ */
+static void test_pairing()
+{
+	const uint8_t move[] = {1, BIN_OP_MOVE, 0x64, 0x00, 0x01, 0x00, 0x00, 0x00};
+	const uint8_t move2[] = {2, BIN_OP_MOVE, 0x64, 0x00, 0x01, 0x00, 0x00, 0x00};
+
+	/* Not paired */
+	pendant->send(macCtrl, move, sizeof(move));
+	TEST_ASSERT_EQUAL_INT(0, moves);
+	TEST_ASSERT_EQUAL_INT(0, replies);
+	TEST_ASSERT_EQUAL_UINT32(1, en->m_rejected);
+	/* Paired in the window, still served after it closed */
+	TEST_ASSERT_FALSE(en->pair(0));
+	TEST_ASSERT_FALSE(en->pair(ESPNOW_PAIR_MAX + 1));
+	en->pair(5);
+	pendant->send(macCtrl, move, sizeof(move));
+	TEST_ASSERT_EQUAL_INT(1, moves);
+	nativeTime += 5000;
+	TEST_ASSERT_FALSE(en->pairing());
+	pendant->send(macCtrl, move2, sizeof(move2));
+	TEST_ASSERT_EQUAL_INT(2, moves);
+	/* New sender after the window */
+	ctrl->connect(other);
+	other->send(macCtrl, move, sizeof(move));
+	TEST_ASSERT_EQUAL_INT(2, moves);
+	TEST_ASSERT_EQUAL_UINT32(2, en->m_rejected);
+	/* EN,0 forgets the paired ones */
+	ctrl->connect(pendant);
+	en->unpair();
+	pendant->send(macCtrl, move, sizeof(move));
+	TEST_ASSERT_EQUAL_INT(2, moves);
+	TEST_ASSERT_EQUAL_UINT32(3, en->m_rejected);
+}
+//====================================================================================
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_command_reply);
+	RUN_TEST(test_duplicate);
+	RUN_TEST(test_text_command);
+	RUN_TEST(test_unknown_opcode);
+	RUN_TEST(test_pairing);
+	return UNITY_END();
+}
+//====================================================================================
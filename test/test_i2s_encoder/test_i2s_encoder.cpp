@@ -0,0 +1,144 @@
+/*
+ * Host test: I2S step encoder -> decoder round trip (pio test -e native).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include <unity.h>
+#include "i2s_step_encoder.h"
+
+#define PULSE     (4)
+#define WORDS     (16)
+#define MAX_EDGES (512)
+
+/*!
+ * \brief Step source with a fixed list of intervals [slots].
+ */
+class ListSource {
+public:
+	ListSource(const uint32_t *iv, uint32_t n): m_iv(iv), m_n(n), m_pos(0) {}
+	bool next(uint32_t *interval) {
+		if (m_pos == m_n) return false;
+		*interval = m_iv[m_pos++];
+		return true;
+	}
+public:
+	const uint32_t *m_iv;
+	uint32_t        m_n;
+	uint32_t        m_pos;
+};
+
+static uint32_t edges[MAX_EDGES];
+static uint32_t highSlots;
+
+/*!
+ * \brief Encode the whole source buffer by buffer, decode rising edges back.
+ * \return number of decoded edges.
+ */
+static uint32_t roundTrip(ListSource &src, uint32_t *encoded)
+{
+	I2SStepEncoder enc(PULSE);
+	I2SStepDecoder dec;
+	uint32_t buf[WORDS], n = 0, i, loops = 0;
+
+	*encoded  = 0;
+	highSlots = 0;
+	do {
+		*encoded += enc.encode(buf, WORDS, src);
+		n += dec.decode(buf, WORDS, edges + n, MAX_EDGES - n);
+		for (i = 0; i < WORDS; ++i) highSlots += __builtin_popcount(buf[i]);
+	} while (!enc.idle() && (++loops < 1000));
+	return n;
+}
+//====================================================================================
+
+void setUp() {}
+void tearDown() {}
+
+/*!
+ * \brief Edges come back at the planned slots, also across buffer boundaries.
+ */
+static void test_constant_rate()
+{
+	uint32_t iv[100], encoded, n, i;
+
+	for (i = 0; i < 100; ++i) iv[i] = 37;     // Not a divisor of 32 * WORDS
+	ListSource src(iv, 100);
+	n = roundTrip(src, &encoded);
+	TEST_ASSERT_EQUAL_UINT32(100, encoded);
+	TEST_ASSERT_EQUAL_UINT32(100, n);
+	for (i = 0; i < n; ++i) TEST_ASSERT_EQUAL_UINT32(37 * (i + 1), edges[i]);
+	TEST_ASSERT_EQUAL_UINT32(100 * PULSE, highSlots);
+}
+//====================================================================================
+
+/*!
+ * \brief Ramp up and down (varying intervals), every interval is kept exactly.
+ */
+static void test_ramp()
+{
+	uint32_t iv[64], encoded, n, i, t = 0;
+
+	for (i = 0; i < 32; ++i) iv[i] = 300 - i * 8;
+	for (i = 32; i < 64; ++i) iv[i] = iv[63 - i];
+	ListSource src(iv, 64);
+	n = roundTrip(src, &encoded);
+	TEST_ASSERT_EQUAL_UINT32(64, n);
+	for (i = 0; i < n; ++i) {
+		t += iv[i];
+		TEST_ASSERT_EQUAL_UINT32(t, edges[i]);
+	}
+}
+//====================================================================================
+
+/*!
+ * \brief Intervals shorter than the pulse are stretched, STEP is low for one slot at least.
+ */
+static void test_short_interval()
+{
+	const uint32_t iv[] = {10, 2, PULSE, PULSE + 1};
+	uint32_t encoded, n;
+
+	ListSource src(iv, 4);
+	n = roundTrip(src, &encoded);
+	TEST_ASSERT_EQUAL_UINT32(4, n);
+	TEST_ASSERT_EQUAL_UINT32(10, edges[0]);
+	TEST_ASSERT_EQUAL_UINT32(10 + PULSE + 1, edges[1]);
+	TEST_ASSERT_EQUAL_UINT32(10 + 2 * (PULSE + 1), edges[2]);
+	TEST_ASSERT_EQUAL_UINT32(10 + 3 * (PULSE + 1), edges[3]);
+	TEST_ASSERT_EQUAL_UINT32(4 * PULSE, highSlots);
+}
+//====================================================================================
+
+/*!
+ * \brief A pulse started in the last slots of a buffer continues in the next one.
+ */
+static void test_pulse_across_buffers()
+{
+	const uint32_t iv[] = {WORDS * 32 - 2};
+	I2SStepEncoder enc(PULSE);
+	uint32_t buf[WORDS];
+
+	ListSource src(iv, 1);
+	TEST_ASSERT_EQUAL_UINT32(1, enc.encode(buf, WORDS, src));
+	TEST_ASSERT_EQUAL_UINT32(0x00000003, buf[WORDS - 1]);
+	TEST_ASSERT_FALSE(enc.idle());
+	TEST_ASSERT_EQUAL_UINT32(0, enc.encode(buf, WORDS, src));
+	TEST_ASSERT_EQUAL_UINT32(0xc0000000, buf[0]);
+	TEST_ASSERT_TRUE(enc.idle());
+}
+//====================================================================================
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_constant_rate);
+	RUN_TEST(test_ramp);
+	RUN_TEST(test_short_interval);
+	RUN_TEST(test_pulse_across_buffers);
+	return UNITY_END();
+}
+//====================================================================================
@@ -0,0 +1,95 @@
+/*
+ * Host test: ResponseWriter buffering and the "N<seq> " prefix (pio test -e native).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include <unity.h>
+#include <string>
+#include "Command.h"
+
+/*!
+ * \brief Connection that keeps every print() call.
+ */
+class RecordCommand: public Command {
+public:
+	RecordCommand(): Command(NULL), m_prints(0) {}
+	virtual void print(const char *s, int len) {
+		m_out.append(s, len);
+		if (m_prints == 0) m_first.assign(s, len);
+		m_prints++;
+	}
+public:
+	std::string m_out;
+	std::string m_first;
+	int         m_prints;
+};
+
+void setUp() {}
+void tearDown() {}
+
+/*!
+ * \brief Short reply: one print with the sequence number in front.
+ */
+static void test_prefix()
+{
+	RecordCommand c;
+
+	ResponseWriter(&c, 5).printf("x_pos=%d\r\n", 12).ok();
+	TEST_ASSERT_EQUAL_INT(1, c.m_prints);
+	TEST_ASSERT_EQUAL_STRING("N5 x_pos=12\r\nOK\r\n", c.m_out.c_str());
+}
+//====================================================================================
+
+/*!
+ * \brief Reply longer than the buffer: prefix on the first part only, nothing lost.
+ */
+static void test_long_reply()
+{
+	RecordCommand c;
+	std::string expected = "N3 ";
+	char line[64];
+	int i;
+
+	{
+		ResponseWriter w(&c, 3);
+		for (i = 0; i < 20; ++i) {
+			snprintf(line, sizeof(line), "line=%02d,0123456789012345678901234567890123456789\r\n", i);
+			w.printf("%s", line);
+			expected += line;
+		}
+	}
+	TEST_ASSERT_TRUE(c.m_prints > 1);
+	TEST_ASSERT_EQUAL_STRING_LEN("N3 line=00", c.m_first.c_str(), 10);
+	TEST_ASSERT_EQUAL_STRING(expected.c_str(), c.m_out.c_str());
+}
+//====================================================================================
+
+/*!
+ * \brief Single piece longer than the buffer right after the prefix: the sequence
+ * number is kept, the piece is truncated to the buffer.
+ */
+static void test_oversized_piece()
+{
+	RecordCommand c;
+	std::string big(RESPONSE_BUFFER + 40, 'a');
+
+	ResponseWriter(&c, 7).printf("%s", big.c_str());
+	TEST_ASSERT_EQUAL_INT(1, c.m_prints);
+	TEST_ASSERT_EQUAL_INT(RESPONSE_BUFFER, c.m_out.length());
+	TEST_ASSERT_EQUAL_STRING_LEN("N7 aaaa", c.m_out.c_str(), 7);
+}
+//====================================================================================
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_prefix);
+	RUN_TEST(test_long_reply);
+	RUN_TEST(test_oversized_piece);
+	return UNITY_END();
+}
+//====================================================================================
@@ -0,0 +1,215 @@
+/*
+ * Host test: TMC2208 datagrams, CRC and the IFCNT write check (pio test -e native).
+ *
+ * Author: Rafal Vonau <rafal.vonau@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ */
+#include <unity.h>
+#include <string.h>
+#include "TMC2208.h"
+
+/*!
+ * \brief Driver on the other end of the single wire: echoes every byte (if the port
+ * does), answers reads, takes writes with a valid CRC and counts them in IFCNT.
+ */
+class FakeDriver: public TMC2208Uart {
+public:
+	FakeDriver(bool echo = true): m_rxLen(0), m_rxPos(0), m_echo(echo), m_ignoreWrites(false), m_silent(false), m_badCrc(false) {
+		memset(m_regs, 0, sizeof(m_regs));
+		memset(m_lastWrite, 0, sizeof(m_lastWrite));
+	}
+	virtual size_t write(const uint8_t *data, size_t len) {
+		uint8_t r[8];
+
+		if (m_echo) push(data, len);          // Single wire echo
+		if ((len == 4) && (data[3] == TMC2208::crc(data, 3)) && !(data[2] & 0x80)) {
+			if (m_silent) return len;
+			r[0] = 0x05;
+			r[1] = 0xff;
+			r[2] = data[2];
+			r[3] = m_regs[data[2]] >> 24;
+			r[4] = m_regs[data[2]] >> 16;
+			r[5] = m_regs[data[2]] >> 8;
+			r[6] = m_regs[data[2]];
+			r[7] = TMC2208::crc(r, 7) ^ (m_badCrc ? 1 : 0);
+			push(r, 8);
+		} else if ((len == 8) && (data[7] == TMC2208::crc(data, 7)) && (data[2] & 0x80)) {
+			memcpy(m_lastWrite, data, 8);
+			if (!m_ignoreWrites) {
+				m_regs[data[2] & 0x7f] = ((uint32_t)data[3] << 24) | ((uint32_t)data[4] << 16) | ((uint32_t)data[5] << 8) | data[6];
+				m_regs[TMC2208_IFCNT] = (m_regs[TMC2208_IFCNT] + 1) & 0xff;
+			}
+		}
+		return len;
+	}
+	virtual int read(uint32_t timeoutMs) {
+		return (m_rxPos < m_rxLen) ? m_rx[m_rxPos++] : -1;
+	}
+	virtual void clear() {m_rxLen = m_rxPos = 0;}
+	virtual bool echo() const {return m_echo;}
+protected:
+	void push(const uint8_t *data, size_t len) {
+		memcpy(m_rx + m_rxLen, data, len);
+		m_rxLen += len;
+	}
+public:
+	uint8_t  m_rx[64];
+	size_t   m_rxLen;
+	size_t   m_rxPos;
+	bool     m_echo;                          // Port receives its own bytes
+	uint32_t m_regs[128];
+	uint8_t  m_lastWrite[8];
+	bool     m_ignoreWrites;                  // Datagrams are lost (IFCNT does not move)
+	bool     m_silent;                        // No answer to reads
+	bool     m_badCrc;                        // Answers with a wrong CRC
+};
+
+void setUp() {}
+void tearDown() {}
+
+/*!
+ * \brief CRC8 of datasheet style datagrams (polynomial 0x07, LSB first).
+ */
+static void test_crc()
+{
+	const uint8_t readGconf[] = {0x05, 0x00, 0x00};
+	const uint8_t readIfcnt[] = {0x05, 0x00, 0x02};
+	const uint8_t writeGconf[] = {0x05, 0x00, 0x80, 0x00, 0x00, 0x01, 0xc1};
+
+	TEST_ASSERT_EQUAL_HEX8(0x48, TMC2208::crc(readGconf, 3));
+	TEST_ASSERT_EQUAL_HEX8(0x8f, TMC2208::crc(readIfcnt, 3));
+	TEST_ASSERT_EQUAL_HEX8(0x7f, TMC2208::crc(writeGconf, 7));
+}
+//====================================================================================
+
+static void test_mres()
+{
+	TEST_ASSERT_EQUAL_INT(8, TMC2208::mres(1));
+	TEST_ASSERT_EQUAL_INT(4, TMC2208::mres(16));
+	TEST_ASSERT_EQUAL_INT(0, TMC2208::mres(256));
+	TEST_ASSERT_EQUAL_INT(-1, TMC2208::mres(3));
+	TEST_ASSERT_EQUAL_INT(-1, TMC2208::mres(512));
+}
+//====================================================================================
+
+/*!
+ * \brief Register write datagram bytes, the write is confirmed by IFCNT.
+ */
+static void test_write_datagram()
+{
+	const uint8_t expected[8] = {0x05, 0x00, 0xec, 0x14, 0x00, 0x00, 0x53, 0x52};
+	FakeDriver drv;
+	TMC2208 tmc(&drv);
+
+	TEST_ASSERT_TRUE(tmc.setMicrosteps(16));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, drv.m_lastWrite, 8);
+	TEST_ASSERT_EQUAL_UINT32(0x14000053, drv.m_regs[TMC2208_CHOPCONF]);
+	TEST_ASSERT_EQUAL_UINT32(1, drv.m_regs[TMC2208_IFCNT]);
+	TEST_ASSERT_EQUAL_INT(16, tmc.microsteps());
+	TEST_ASSERT_EQUAL_UINT32(0, tmc.m_errors);
+}
+//====================================================================================
+
+/*!
+ * \brief begin(): GCONF then CHOPCONF, both counted by the driver.
+ */
+static void test_begin()
+{
+	FakeDriver drv;
+	TMC2208 tmc(&drv);
+
+	TEST_ASSERT_TRUE(tmc.begin(4));
+	TEST_ASSERT_EQUAL_UINT32(0x1c1, drv.m_regs[TMC2208_GCONF]);
+	TEST_ASSERT_EQUAL_UINT32(0x16000053, drv.m_regs[TMC2208_CHOPCONF]);
+	TEST_ASSERT_EQUAL_UINT32(2, drv.m_regs[TMC2208_IFCNT]);
+}
+//====================================================================================
+
+/*!
+ * \brief A datagram the driver did not take fails and keeps the old resolution.
+ */
+static void test_lost_write()
+{
+	FakeDriver drv;
+	TMC2208 tmc(&drv);
+
+	TEST_ASSERT_TRUE(tmc.setMicrosteps(16));
+	drv.m_ignoreWrites = true;
+	TEST_ASSERT_FALSE(tmc.setMicrosteps(4));
+	TEST_ASSERT_EQUAL_INT(16, tmc.microsteps());
+	TEST_ASSERT_EQUAL_UINT32(0x14000053, tmc.m_chopconf);
+	TEST_ASSERT_EQUAL_UINT32(1, tmc.m_errors);
+}
+//====================================================================================
+
+/*!
+ * \brief IFCNT is 8 bit, a write across the wrap is still confirmed.
+ */
+static void test_ifcnt_wrap()
+{
+	FakeDriver drv;
+	TMC2208 tmc(&drv);
+
+	drv.m_regs[TMC2208_IFCNT] = 0xff;
+	TEST_ASSERT_TRUE(tmc.writeRegister(TMC2208_GCONF, 0x1c1));
+	TEST_ASSERT_EQUAL_UINT32(0, drv.m_regs[TMC2208_IFCNT]);
+}
+//====================================================================================
+
+/*!
+ * \brief Read answer parsing, missing and corrupted answers fail.
+ */
+static void test_read()
+{
+	FakeDriver drv;
+	TMC2208 tmc(&drv);
+	uint32_t v = 0;
+
+	drv.m_regs[TMC2208_MSCNT] = 0x12345678;
+	TEST_ASSERT_TRUE(tmc.readRegister(TMC2208_MSCNT, &v));
+	TEST_ASSERT_EQUAL_UINT32(0x12345678, v);
+	drv.m_badCrc = true;
+	TEST_ASSERT_FALSE(tmc.readRegister(TMC2208_MSCNT, &v));
+	drv.m_badCrc = false;
+	drv.m_silent = true;
+	TEST_ASSERT_FALSE(tmc.readRegister(TMC2208_MSCNT, &v));
+	TEST_ASSERT_FALSE(tmc.setMicrosteps(8));
+	TEST_ASSERT_EQUAL_UINT32(3, tmc.m_errors);
+}
+//====================================================================================
+
+/*!
+ * \brief Port without echo (SoftwareSerial one wire): reads and checked writes work.
+ */
+static void test_no_echo()
+{
+	FakeDriver drv(false);
+	TMC2208 tmc(&drv);
+	uint32_t v = 0;
+
+	drv.m_regs[TMC2208_MSCNT] = 0x12345678;
+	TEST_ASSERT_TRUE(tmc.readRegister(TMC2208_MSCNT, &v));
+	TEST_ASSERT_EQUAL_UINT32(0x12345678, v);
+	TEST_ASSERT_TRUE(tmc.begin(16));
+	TEST_ASSERT_EQUAL_UINT32(0x14000053, drv.m_regs[TMC2208_CHOPCONF]);
+	TEST_ASSERT_EQUAL_UINT32(0, tmc.m_errors);
+}
+//====================================================================================
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_crc);
+	RUN_TEST(test_mres);
+	RUN_TEST(test_write_datagram);
+	RUN_TEST(test_begin);
+	RUN_TEST(test_lost_write);
+	RUN_TEST(test_ifcnt_wrap);
+	RUN_TEST(test_read);
+	RUN_TEST(test_no_echo);
+	return UNITY_END();
+}
+//====================================================================================
@@ -5,9 +5,17 @@ function addMessage(m)
 	$("#console").append(m+"</br>");
 }
 
+/* Commands, replies and telemetry over one WebSocket, /post and /events only when it is not open */
+var ws = null;
+var es = null;
+
 function sendCommand(c)
 {
 	console.log(c);
+	if (ws && (ws.readyState == WebSocket.OPEN)) {
+		ws.send(c);
+		return;
+	}
 	$.ajax({
 		url:"post",
 		type:"POST",
@@ -19,30 +27,37 @@ function sendCommand(c)
 	});
 }
 
+function showCnt(cnt)
+{
+	if (cnt == 0) {
+		$('#but_cut').html('TNIJ');
+		$('#but_cut').prop('disabled', false);
+	} else {
+		$('#but_cut').html(`${cnt}`);
+		$('#but_cut').prop('disabled', true);
+	}
+}
+
 function getCnt()
 {
+	if (ws && (ws.readyState == WebSocket.OPEN)) return;   /* Telemetry has it */
 	$.ajax({
 		url:"cnt",
 		type:"GET",
 		dataType: "json",
 		success:function(data) {
 			console.log(data);
-			const cnt = data.cnt;
-			if (cnt == 0) {
-				$('#but_cut').html('TNIJ');
-				$('#but_cut').prop('disabled', false);
-			} else {
-				$('#but_cut').html(`${cnt}`);
-				$('#but_cut').prop('disabled', true);
-			}
+			showCnt(data.cnt);
 		}
 	});
 }
 
 
+/* Replies of /post commands and of /batch jobs */
 function startEvents() 
 {
-	var es = new EventSource('/events');
+	if (es) return;
+	es = new EventSource('/events');
 	es.onopen = function(e) {
 		addMessage("Events Opened");
 	};
@@ -56,16 +71,49 @@ function startEvents()
 	};
 	es.addEventListener('cmd', function(e) {
 		addMessage("Event[cmd]: " + e.data);
-		if (e.data == "OK") {
-			//sendCommand();
-		}
 	}, false);
 }
 
+function stopEvents()
+{
+	if (!es) return;
+	es.close();
+	es = null;
+}
+
+function startSocket()
+{
+	ws = new WebSocket(`ws://${location.host}/ws`);
+	ws.onopen = function(e) {
+		addMessage("WebSocket Opened");
+		stopEvents();
+	};
+	ws.onclose = function(e) {
+		addMessage("WebSocket Closed");
+		startEvents();
+		$('#status').html('offline');
+		setTimeout(startSocket, 2000);
+	};
+	ws.onmessage = function(e) {
+		e.data.split("\r\n").forEach(function(line) {
+			if (line.length == 0) return;
+			/* Telemetry: <Run|Hold|Idle,pos=,target=,queue=,cut=,feed=> */
+			if (line[0] == '<') {
+				$('#status').text(line);
+				const m = line.match(/cut=(-?\d+)/);
+				if (m) showCnt(parseInt(m[1]));
+				return;
+			}
+			addMessage("Cmd: " + line);
+		});
+	};
+}
+
 $(document).ready(function()
 {
 	const speed = 16; /* 60 mm/s */
 	startEvents();
+	startSocket();
 	$("#but_left").click(function(){ sendCommand("MR,1000,-1");});
 	$("#but_right").click(function(){ sendCommand("MR,1000,1");});
 	$("#but_left2").click(function(){ sendCommand("MR,2000,-2");});